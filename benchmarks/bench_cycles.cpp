@@ -0,0 +1,219 @@
+// Google Benchmark suite for the simulation, the serialization of the game
+// states and their parsing by the clients. Run with
+// --benchmark_format=json or --benchmark_out=<file> for machine readable
+// results
+#include "api.h"
+#include "server/game_logic.h"
+#include "server/room.h"
+#include "transport.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <spdlog/spdlog.h>
+
+using namespace cycles_server;
+using cycles::Direction;
+
+namespace {
+
+// Frames played before measuring, enough for the tails to be grown
+constexpr int warmupFrames = 60;
+
+Configuration makeConfiguration(int gridSize) {
+  Configuration conf("");
+  conf.gridWidth = gridSize;
+  conf.gridHeight = gridSize;
+  conf.maxClients = 255;
+  return conf;
+}
+
+// Each player moves to the first free cell around its head, so that most of
+// them survive and the grid fills with their tails
+std::map<Id, Direction> chooseMoves(Game &game, int gridSize) {
+  const auto &grid = game.getGrid();
+  std::map<Id, Direction> moves;
+  for (const auto &[id, player] : game.getPlayers()) {
+    moves[id] = Direction::north;
+    for (auto direction : {Direction::north, Direction::east,
+                           Direction::south, Direction::west}) {
+      const auto next = player.position + cycles::getDirectionVector(direction);
+      if (next.x >= 0 && next.x < gridSize && next.y >= 0 &&
+          next.y < gridSize && grid[next.y * gridSize + next.x] == 0) {
+        moves[id] = direction;
+        break;
+      }
+    }
+  }
+  return moves;
+}
+
+// A game with the given players, played until they have tails
+std::unique_ptr<Game> makeGame(int gridSize, int players,
+                               int frames = warmupFrames) {
+  auto game = std::make_unique<Game>(makeConfiguration(gridSize));
+  for (int i = 0; i < players; ++i) {
+    game->addPlayer("player" + std::to_string(i));
+  }
+  for (int frame = 0; frame < frames; ++frame) {
+    game->setFrame(frame);
+    game->movePlayers(chooseMoves(*game, gridSize));
+  }
+  return game;
+}
+
+double getOccupancy(Game &game) {
+  const auto &grid = game.getGrid();
+  return std::count_if(grid.begin(), grid.end(),
+                       [](Id cell) { return cell != 0; }) /
+         double(grid.size());
+}
+
+// Player counts from 2 to 255 and grids from 100x100 to 2000x2000
+void playersAndGrids(benchmark::internal::Benchmark *benchmark) {
+  benchmark->ArgNames({"players", "grid"});
+  for (int grid : {100, 500, 2000}) {
+    for (int players : {2, 16, 64, 255}) {
+      benchmark->Args({players, grid});
+    }
+  }
+}
+
+// The moves are chosen while the timer is paused. Collisions are checked
+// by movePlayers, the games that end are started again
+void BM_MovePlayers(benchmark::State &state) {
+  const int players = state.range(0);
+  const int gridSize = state.range(1);
+  auto game = makeGame(gridSize, players);
+  int frame = warmupFrames;
+  for (auto _ : state) {
+    state.PauseTiming();
+    if (game->getPlayers().size() < 2) {
+      game = makeGame(gridSize, players);
+      frame = warmupFrames;
+    }
+    game->setFrame(frame++);
+    auto moves = chooseMoves(*game, gridSize);
+    state.ResumeTiming();
+    game->movePlayers(std::move(moves));
+  }
+  state.counters["occupancy"] = getOccupancy(*game);
+}
+BENCHMARK(BM_MovePlayers)->Apply(playersAndGrids);
+
+// Every player turns back into its own tail, so all of them collide. The
+// same game is played again in every iteration, only movePlayers is timed
+void BM_CheckCollisions(benchmark::State &state) {
+  const int players = state.range(0);
+  const int gridSize = state.range(1);
+  Game game(makeConfiguration(gridSize));
+  for (auto _ : state) {
+    // A single frame is enough to have a tail to turn back into
+    game.reset();
+    for (int i = 0; i < players; ++i) {
+      game.addPlayer("player" + std::to_string(i));
+    }
+    game.movePlayers(chooseMoves(game, gridSize));
+    std::map<Id, Direction> moves;
+    for (const auto &[id, player] : game.getPlayers()) {
+      if (player.tail.empty()) {
+        continue;
+      }
+      const auto back = player.tail.front() - player.position;
+      moves[id] = back.x > 0   ? Direction::east
+                  : back.x < 0 ? Direction::west
+                  : back.y > 0 ? Direction::south
+                               : Direction::north;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    game.movePlayers(std::move(moves));
+    state.SetIterationTime(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count());
+  }
+}
+BENCHMARK(BM_CheckCollisions)->Apply(playersAndGrids)->UseManualTime();
+
+// Adds a player to a game that already has the given players with their
+// tails, the occupancy of the grid is reported
+void BM_AddPlayer(benchmark::State &state) {
+  const int players = state.range(0);
+  const int gridSize = state.range(1);
+  auto game = makeGame(gridSize, players);
+  double occupancy = getOccupancy(*game);
+  int added = 0;
+  for (auto _ : state) {
+    // Ids run out after 255 players
+    if (players + added >= 254) {
+      state.PauseTiming();
+      game = makeGame(gridSize, players);
+      added = 0;
+      state.ResumeTiming();
+    }
+    benchmark::DoNotOptimize(game->addPlayer("joining"));
+    ++added;
+  }
+  state.counters["occupancy"] = occupancy;
+}
+BENCHMARK(BM_AddPlayer)
+    ->ArgNames({"players", "grid"})
+    ->ArgsProduct({{2, 16, 64, 200}, {100, 500, 2000}});
+
+// The state a room sends to the clients that see the whole grid
+void BM_SerializeState(benchmark::State &state) {
+  const int players = state.range(0);
+  const int gridSize = state.range(1);
+  auto game = makeGame(gridSize, players);
+  const auto playersInGame = game->getPlayers();
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    auto packet = detail::makeStateHeader(sf::Vector2i(gridSize, gridSize),
+                                          playersInGame, warmupFrames, 0);
+    detail::appendGridWindow(packet, game->getGrid(), gridSize,
+                             sf::IntRect(0, 0, gridSize, gridSize));
+    bytes = packet.getDataSize();
+    benchmark::DoNotOptimize(packet.getData());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_SerializeState)->Apply(playersAndGrids);
+
+// A client receiving and parsing the state, through the in-process
+// transport so that only the parsing and the hand over are measured
+void BM_ParseState(benchmark::State &state) {
+  const int players = state.range(0);
+  const int gridSize = state.range(1);
+  auto game = makeGame(gridSize, players);
+  auto packet = std::make_shared<sf::Packet>(detail::makeStateHeader(
+      sf::Vector2i(gridSize, gridSize), game->getPlayers(), warmupFrames, 0));
+  detail::appendGridWindow(*packet, game->getGrid(), gridSize,
+                           sf::IntRect(0, 0, gridSize, gridSize));
+  auto [server, client] = cycles::makeInProcessTransportPair();
+  cycles::Connection connection(client);
+  cycles::GameState received;
+  for (auto _ : state) {
+    server->sendLatest(packet);
+    connection.receiveGameState(received);
+    benchmark::DoNotOptimize(received.grid.data());
+  }
+  if (!connection.isActive()) {
+    state.SkipWithError("The state could not be parsed");
+  }
+  state.SetBytesProcessed(state.iterations() * packet->getDataSize());
+}
+BENCHMARK(BM_ParseState)->Apply(playersAndGrids);
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // Configurations are made without a file, and the games log every move
+  spdlog::set_level(spdlog::level::off);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
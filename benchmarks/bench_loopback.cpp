@@ -0,0 +1,281 @@
+// End to end benchmark of a headless server and its clients over loopback.
+// For every number of players and grid size it starts the server in its own
+// process, plays a match with that many clients in threads of this one,
+// which stop after a fixed number of frames, and prints a CSV line with:
+//  - The frame time measured by the server, the part of it spent sending the
+//    states and simulating the moves, and the tick rate it allows
+//  - The latency of the states, from the server sending them to the clients
+//    receiving them, and the round trip from a client sending its move to
+//    receiving the next state, as p50, p99 and p999 in microseconds
+//  - The bytes of state sent in each frame
+// Nothing needs a display, so it can run unattended.
+//
+// Usage: bench_loopback [--server path] [--players 2,16,64] [--grids 100,500]
+//                       [--frames 300] [--port 50200]
+#include "api.h"
+#include "server/snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <signal.h>
+#include <spawn.h>
+#include <spdlog/spdlog.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+
+struct Options {
+  std::string server;
+  std::vector<int> players = {2, 16, 64};
+  std::vector<int> grids = {100, 500};
+  int frames = 300;
+  int port = 50200;
+};
+
+std::vector<int> parseList(const std::string &list) {
+  std::vector<int> values;
+  std::stringstream stream(list);
+  for (std::string value; std::getline(stream, value, ',');) {
+    values.push_back(std::stoi(value));
+  }
+  return values;
+}
+
+// The value below which a fraction q of the sorted samples are
+double percentile(const std::vector<sf::Int64> &sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const auto index = std::min(static_cast<std::size_t>(q * sorted.size()),
+                              sorted.size() - 1);
+  return sorted[index];
+}
+
+double mean(const std::vector<sf::Int64> &samples) {
+  if (samples.empty()) {
+    return 0;
+  }
+  return std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+}
+
+// What the clients measured, in microseconds
+struct ClientSamples {
+  std::vector<sf::Int64> latency;
+  std::vector<sf::Int64> roundTrip;
+  std::mutex mutex;
+};
+
+// Moves to the first free cell around its head until the given frame
+void playClient(const std::string &name, int frames, ClientSamples &samples) {
+  cycles::Connection connection;
+  connection.connect(name);
+  std::vector<sf::Int64> latency, roundTrip;
+  cycles::GameState state;
+  sf::Int64 moveSent = 0;
+  while (connection.isActive()) {
+    connection.receiveGameState(state);
+    const auto received = cycles::getMonotonicTime();
+    if (!connection.isActive() || state.frameNumber >= frames) {
+      break;
+    }
+    // The server and the clients share the monotonic clock of the host
+    latency.push_back(received - state.sendTime);
+    if (moveSent != 0) {
+      roundTrip.push_back(received - moveSent);
+    }
+    auto player = std::find_if(
+        state.players.begin(), state.players.end(),
+        [&name](const auto &player) { return player.name == name; });
+    if (player == state.players.end()) {
+      break;
+    }
+    auto move = cycles::Direction::north;
+    for (auto direction : {cycles::Direction::north, cycles::Direction::east,
+                           cycles::Direction::south, cycles::Direction::west}) {
+      const auto next =
+          player->position + cycles::getDirectionVector(direction);
+      if (state.isInsideGrid(next) && state.isCellEmpty(next)) {
+        move = direction;
+        break;
+      }
+    }
+    moveSent = cycles::getMonotonicTime();
+    connection.sendMove(move);
+  }
+  std::scoped_lock lock(samples.mutex);
+  samples.latency.insert(samples.latency.end(), latency.begin(),
+                         latency.end());
+  samples.roundTrip.insert(samples.roundTrip.end(), roundTrip.begin(),
+                           roundTrip.end());
+}
+
+// Starts the server with its output discarded, returns its pid or -1
+pid_t startServer(const std::string &server, const std::string &config) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  std::vector<char *> arguments = {const_cast<char *>(server.c_str()),
+                                   const_cast<char *>(config.c_str()),
+                                   nullptr};
+  pid_t pid = -1;
+  const int error = posix_spawn(&pid, server.c_str(), &actions, nullptr,
+                                arguments.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  return error == 0 ? pid : -1;
+}
+
+// Waits for the server to exit, and kills it if it takes too long
+void stopServer(pid_t pid) {
+  sf::Clock clock;
+  int status;
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    if (clock.getElapsedTime() > sf::seconds(10)) {
+      spdlog::warn("The server did not exit, killing it");
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+      return;
+    }
+    sf::sleep(sf::milliseconds(10));
+  }
+}
+
+// Plays one match and prints its line, returns false if it could not
+bool run(const Options &options, int players, int grid, int port) {
+  const auto directory = std::filesystem::temp_directory_path() /
+                         ("cycles-loopback-" + std::to_string(getpid()));
+  std::filesystem::create_directories(directory);
+  const auto config = (directory / "config.yaml").string();
+  const auto stats = (directory / "frames.csv").string();
+  std::filesystem::remove(stats);
+  {
+    std::ofstream out(config);
+    out << "headless: true\n"
+        << "maxClients: " << players << "\n"
+        << "startPlayers: " << players << "\n"
+        << "joinTimeout: 10\n"
+        << "gridWidth: " << grid << "\n"
+        << "gridHeight: " << grid << "\n"
+        << "frameTime: 0\n"
+        << "frameStatsFile: " << stats << "\n";
+  }
+  setenv("CYCLES_PORT", std::to_string(port).c_str(), 1);
+  const auto pid = startServer(options.server, config);
+  if (pid < 0) {
+    spdlog::critical("Could not start {}", options.server);
+    return false;
+  }
+  // The server publishes the snapshots once it listens
+  cycles_server::SnapshotReader reader;
+  sf::Clock clock;
+  while (!reader.attach(cycles_server::getSnapshotSegmentName(port))) {
+    if (clock.getElapsedTime() > sf::seconds(10)) {
+      spdlog::critical("The server did not start");
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return false;
+    }
+    sf::sleep(sf::milliseconds(10));
+  }
+  ClientSamples samples;
+  std::vector<std::thread> clients;
+  for (int i = 0; i < players; ++i) {
+    clients.emplace_back(playClient, "bot" + std::to_string(i),
+                         options.frames, std::ref(samples));
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+  stopServer(pid);
+  // room,match,frame,players,frame us,send us,simulate us,bytes
+  std::vector<sf::Int64> frameTime, sendTime, simulateTime, bytes;
+  std::ifstream in(stats);
+  for (std::string line; std::getline(in, line);) {
+    std::vector<sf::Int64> fields;
+    std::stringstream stream(line);
+    for (std::string field; std::getline(stream, field, ',');) {
+      fields.push_back(std::stoll(field));
+    }
+    if (fields.size() != 8) {
+      continue;
+    }
+    frameTime.push_back(fields[4]);
+    sendTime.push_back(fields[5]);
+    simulateTime.push_back(fields[6]);
+    bytes.push_back(fields[7]);
+  }
+  std::filesystem::remove_all(directory);
+  std::sort(frameTime.begin(), frameTime.end());
+  std::sort(samples.latency.begin(), samples.latency.end());
+  std::sort(samples.roundTrip.begin(), samples.roundTrip.end());
+  const double meanFrame = mean(frameTime);
+  std::printf("%d,%d,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f,"
+              "%.0f,%.0f\n",
+              players, grid, frameTime.size(), meanFrame,
+              percentile(frameTime, 0.99), mean(sendTime),
+              mean(simulateTime), meanFrame > 0 ? 1e6 / meanFrame : 0.0,
+              percentile(samples.latency, 0.5),
+              percentile(samples.latency, 0.99),
+              percentile(samples.latency, 0.999),
+              percentile(samples.roundTrip, 0.5),
+              percentile(samples.roundTrip, 0.99),
+              percentile(samples.roundTrip, 0.999), mean(bytes));
+  std::fflush(stdout);
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  spdlog::set_level(spdlog::level::warn);
+  Options options;
+  // The server is built next to this program
+  options.server =
+      (std::filesystem::path(argv[0]).parent_path() / "server").string();
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string option = argv[i];
+    const std::string value = argv[i + 1];
+    if (option == "--server") {
+      options.server = value;
+    } else if (option == "--players") {
+      options.players = parseList(value);
+    } else if (option == "--grids") {
+      options.grids = parseList(value);
+    } else if (option == "--frames") {
+      options.frames = std::stoi(value);
+    } else if (option == "--port") {
+      options.port = std::stoi(value);
+    } else {
+      spdlog::critical("Unknown option {}", option);
+      return 1;
+    }
+  }
+  std::printf("players,grid,frames,frame_us,frame_p99_us,send_us,"
+              "simulate_us,ticks_per_s,latency_p50_us,latency_p99_us,"
+              "latency_p999_us,round_trip_p50_us,round_trip_p99_us,"
+              "round_trip_p999_us,bytes_per_frame\n");
+  // Every match gets its own port, the previous one may still be in use
+  int port = options.port;
+  bool failed = false;
+  for (int grid : options.grids) {
+    for (int players : options.players) {
+      failed = !run(options, players, grid, port++) || failed;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "api.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace cycles {
+
+/**
+ * @brief The view of the current frame given to an anytime search
+ *
+ * The search should publish a move as soon as it has one and keep improving
+ * it until shouldStop returns true.
+ */
+class SearchContext {
+  friend class AnytimeHarness;
+  const GameState &state;
+  const Player &player;
+  const Connection &connection;
+  std::atomic<bool> stop = false;
+  std::atomic<int> bestMove;
+
+  SearchContext(const GameState &state, const Player &player,
+                const Connection &connection, Direction fallback)
+      : state(state), player(player), connection(connection),
+        bestMove(getDirectionValue(fallback)) {}
+
+public:
+  /**
+   * @brief The game state of the current frame
+   */
+  const GameState &getState() const { return state; }
+
+  /**
+   * @brief The player controlled by the bot
+   */
+  const Player &getPlayer() const { return player; }
+
+  /**
+   * @brief Publish the best move found so far
+   *
+   * Can be called any number of times, the last move published before the
+   * deadline is sent to the server.
+   */
+  void setBestMove(Direction direction) {
+    bestMove = getDirectionValue(direction);
+  }
+
+  /**
+   * @brief Check if the search must return
+   *
+   * The move has already been sent when this becomes true, so the search
+   * should return as soon as possible, it cannot start the next frame until
+   * it does.
+   */
+  bool shouldStop() const { return stop; }
+
+  /**
+   * @brief Time left until the move is sent, see
+   * Connection::getRemainingTime
+   */
+  sf::Time getRemainingTime() const { return connection.getRemainingTime(); }
+};
+
+/**
+ * @brief Runs an anytime (e.g. iterative deepening) search for a bot and
+ * sends its best move just before the deadline of every frame
+ *
+ * The search runs in a worker thread while the harness keeps track of the
+ * time left in the frame. If the search does not publish any move, a move to
+ * a free neighbouring cell is sent.
+ */
+class AnytimeHarness {
+public:
+  /**
+   * @brief The search, called once per frame
+   */
+  using Search = std::function<void(SearchContext &context)>;
+
+  /**
+   * @brief Construct a new harness
+   *
+   * @param connection A connection that has already been established
+   * @param playerName The name used to connect, used to find the player in
+   * the game state
+   * @param search The search to run every frame
+   * @param safetyMargin The move is sent when the remaining time drops below
+   * this margin
+   */
+  AnytimeHarness(Connection &connection, std::string playerName,
+                 Search search, sf::Time safetyMargin = sf::milliseconds(5));
+
+  ~AnytimeHarness();
+
+  /**
+   * @brief Play until the connection is closed
+   */
+  void run();
+
+private:
+  Connection &connection;
+  std::string playerName;
+  Search search;
+  sf::Time safetyMargin;
+  GameState state;
+  std::mutex mutex;
+  std::condition_variable condition;
+  SearchContext *context = nullptr;
+  bool searching = false;
+  bool finished = false;
+  std::thread worker;
+
+  void workerLoop();
+
+  void playFrame(const Player &player);
+};
+
+} // namespace cycles
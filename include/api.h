@@ -1,6 +1,9 @@
 #pragma once
+#include "transport.h"
 #include "utils.h"
 #include <SFML/Graphics.hpp>
+#include <SFML/Network.hpp>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -28,42 +31,96 @@ class Connection;
  */
 struct GameState {
   /**
-   * @brief The grid of the game
+   * @brief The part of the grid visible to the player
    *
    * Each cell is represented by the unique identifier of the player that
-   * occupies it. The value 0 represents an empty cell. The grid is stored in
-   * row-major order and has dimensions gridWidth x gridHeight.
+   * occupies it. The value 0 represents an empty cell. The cells are stored in
+   * row-major order and cover the window of dimensions windowWidth x
+   * windowHeight starting at (windowX, windowY). Unless a view radius was
+   * requested when connecting, the window is the whole grid.
    */
   std::vector<Id> grid;
 
-  int gridWidth;  ///< The width of the grid (in cells)
-  int gridHeight; ///< The height of the grid (in cells)
+  int gridWidth = 0;  ///< The width of the grid (in cells)
+  int gridHeight = 0; ///< The height of the grid (in cells)
+
+  int windowX = 0;      ///< The column of the first cell in the window
+  int windowY = 0;      ///< The row of the first cell in the window
+  int windowWidth = 0;  ///< The width of the window (in cells)
+  int windowHeight = 0; ///< The height of the window (in cells)
 
   /**
    * @brief A vector with the players in the game
    */
   std::vector<Player> players;
 
-  int frameNumber; ///< The number of the current frame
+  int frameNumber = 0; ///< The number of the current frame
+
+  /**
+   * @brief The time at which the server sent this state
+   *
+   * In microseconds, measured with the clock of the server.
+   */
+  sf::Int64 sendTime = 0;
+
+  /**
+   * @brief The time before which the move for this frame must reach the
+   * server
+   *
+   * In microseconds, measured with the clock of the server. Players whose
+   * moves arrive later are removed from the game. See
+   * Connection::getRemainingTime.
+   */
+  sf::Int64 moveDeadline = 0;
 
   GameState() = default;
 
+  /**
+   * @brief The value of the cells outside the window, whose contents are not
+   * known
+   *
+   * It is not 0, so these cells count as occupied. A player can also have
+   * this id, use isInsideWindow to tell them apart.
+   */
+  static constexpr Id unknownCell = 255;
+
   /**
    * @brief Get the value of a cell in the grid
    *
-   * @param position The position of the cell
+   * Only the cells inside the window are known, see isInsideWindow. The
+   * others, including the ones outside the grid, are unknownCell.
+   *
+   * @param position The position of the cell (in grid coordinates)
    * @return Id The identifier of the player occupying the cell (0 if empty)
    */
   Id getGridCell(sf::Vector2i position) const {
-    return grid[position.y * gridWidth + position.x];
+    return getWindowCell(position - sf::Vector2i(windowX, windowY));
+  }
+
+  /**
+   * @brief Get the value of a cell using coordinates relative to the window
+   *
+   * @param position The position of the cell, (0, 0) being the top-left
+   * corner of the window
+   * @return Id The identifier of the player occupying the cell (0 if empty),
+   * or unknownCell if the cell is outside the window
+   */
+  Id getWindowCell(sf::Vector2i position) const {
+    if (position.x < 0 || position.x >= windowWidth || position.y < 0 ||
+        position.y >= windowHeight) {
+      return unknownCell;
+    }
+    return grid[position.y * windowWidth + position.x];
   }
 
   /**
    * @brief Check if a cell is empty
    *
-   * @param position The position of the cell
-   * @return true if the cell is empty
-   * @return false if the cell is not empty
+   * Cells outside the window are not known to be empty.
+   *
+   * @param position The position of the cell (in grid coordinates)
+   * @return true if the cell is inside the window and empty
+   * @return false otherwise
    */
   bool isCellEmpty(sf::Vector2i position) const {
     return getGridCell(position) == 0;
@@ -81,9 +138,21 @@ struct GameState {
            position.y < gridHeight;
   }
 
+  /**
+   * @brief Check if a position is inside the visible window
+   *
+   * @param position The position to check (in grid coordinates)
+   * @return true if the contents of the cell are known
+   * @return false if the cell is outside the window
+   */
+  bool isInsideWindow(sf::Vector2i position) const {
+    return position.x >= windowX && position.x < windowX + windowWidth &&
+           position.y >= windowY && position.y < windowY + windowHeight;
+  }
+
 private:
   friend Connection;
-  GameState(sf::Packet &packet);
+  bool update(const char *data, std::size_t size);
 };
 
 /**
@@ -91,19 +160,71 @@ private:
  * the player's moves.
  */
 class Connection {
-  std::shared_ptr<sf::TcpSocket> socket;
+  std::shared_ptr<Transport> transport;
   int frameNumber = 0;
   int lastFrameSent = -1;
   std::string playerName;
+  // Reused every frame so that sending does not allocate
+  sf::Packet movePacket;
+  // Clock synchronization with the server, in microseconds
+  sf::Int64 clockOffset = 0; // Server clock minus local clock
+  sf::Int64 maxClockOffset = 0;
+  sf::Int64 roundTripTime = 0;
+  sf::Int64 moveDeadline = 0;
+  // Local times at which the handshake was sent and answered
+  sf::Int64 requestTime = 0;
+  sf::Int64 replyTime = 0;
+  bool observer = false;
+
+  void disconnect(const std::string &reason);
+  bool handshake(const sf::Packet &request, sf::Packet &reply);
+  void synchronizeClock(sf::Int64 serverTime);
 
 public:
+  /**
+   * @brief Construct a connection that will use TCP to reach the server
+   *
+   * Bots loaded by the server (see CYCLES_BOT_MAIN) use the in-process
+   * transport given by the server instead.
+   */
+  Connection() = default;
+
+  /**
+   * @brief Construct a connection that will use the given transport
+   *
+   * @param transport A transport already linked to the server
+   */
+  explicit Connection(std::shared_ptr<Transport> transport)
+      : transport(transport) {}
+
   /**
    * @brief Construct a new Connection object
    *
+   * By default the server sends the whole grid every frame. If viewRadius is
+   * positive the server will only send the square window of side
+   * 2*viewRadius+1 centered at the player's head (clipped to the grid), which
+   * greatly reduces the traffic in large grids. The positions of all players
+   * are always sent.
+   *
    * @param playerName The name of the player that is trying to connect
+   * @param viewRadius The radius of the window around the player's head, 0
+   * to receive the whole grid
    * @return sf::Color The color assigned to the player
    */
-  sf::Color connect(std::string playerName);
+  sf::Color connect(std::string playerName, int viewRadius = 0);
+
+  /**
+   * @brief Connect as a spectator, that only receives the game states
+   *
+   * Spectators do not join the game and cannot send moves, the server sends
+   * them the whole grid once the players have sent their moves, so they
+   * never delay the players. When there are many of them they should
+   * connect to a relay instead of the server, see the relay executable.
+   *
+   * @param frameInterval Receive only one of every frameInterval states
+   * @return true if the connection was established
+   */
+  bool observe(int frameInterval = 1);
 
   /**
    * @brief Send the player's move to the server
@@ -112,6 +233,7 @@ public:
    * Will block until the move is sent.
    * Will return without doing nothing if the user is trying to send a move
    * twice in the same frame.
+   * If the move cannot be sent the connection is closed, see isActive.
    *
    * @param direction The direction of the move
    */
@@ -120,13 +242,77 @@ public:
   /**
    * @brief Receive the game state from the server
    *
-   * Will block until the game state is received.
+   * Will block until the game state is received or the connection is lost,
+   * in which case isActive will return false afterwards.
    * Can only be called once per frame.
    *
    * @return GameState The game state
    */
   GameState receiveGameState();
 
+  /**
+   * @brief Receive the game state from the server into an existing GameState
+   *
+   * Same as receiveGameState(), but the contents of state are overwritten in
+   * place. Reusing the same GameState every frame avoids any memory
+   * allocation once the first frame has been received.
+   *
+   * @param state The game state to update
+   */
+  void receiveGameState(GameState &state);
+
+  /**
+   * @brief Receive the game state only if it is already available
+   *
+   * Never blocks. Partially received states are kept, and completed in
+   * later calls.
+   *
+   * @param state The game state to update, left untouched if no new state
+   * is available
+   * @return true if a new game state was received
+   */
+  bool tryReceiveGameState(GameState &state);
+
+  /**
+   * @brief Wait for the game state for at most the given amount of time
+   *
+   * The connection is polled, so this returns as soon as the state arrives.
+   *
+   * @param state The game state to update
+   * @param timeout The maximum time to wait
+   * @return true if a new game state was received
+   */
+  bool waitForGameState(GameState &state, sf::Time timeout);
+
+  /**
+   * @brief Receive the game state in the background
+   *
+   * The state is received in another thread, the bot can keep working in
+   * the meantime. No other method of the connection should be called until
+   * the future is ready. If the connection is lost the future holds a
+   * std::runtime_error.
+   *
+   * @return std::future<GameState> The future game state
+   */
+  std::future<GameState> receiveGameStateAsync();
+
+  /**
+   * @brief Time left to send the move for the last received game state
+   *
+   * The clock offset with the server is estimated from the round trip time
+   * of the handshake and refined with the timestamp of every state. The time
+   * the move takes to reach the server is already subtracted.
+   *
+   * @return sf::Time The remaining time, zero or negative if the deadline
+   * has already passed
+   */
+  sf::Time getRemainingTime() const;
+
+  /**
+   * @brief The round trip time to the server measured during the handshake
+   */
+  sf::Time getRoundTripTime() const;
+
   /**
    * @brief Check if the connection is active
    *
@@ -136,4 +322,80 @@ public:
   bool isActive();
 };
 
+namespace detail {
+/**
+ * @brief Set the transport used by the next Connection connected in the
+ * calling thread, instead of TCP
+ *
+ * Used by CYCLES_BOT_MAIN when the bot is loaded by the server.
+ */
+void setDefaultTransport(std::shared_ptr<Transport> transport);
+
+/**
+ * @brief Connect to the server with the transport selected by the
+ * environment variable CYCLES_TRANSPORT
+ *
+ * @return The transport, nullptr if the server could not be reached
+ */
+std::shared_ptr<Transport> establishLink();
+
+/**
+ * @brief Send a packet and wait until it is completely sent, for at most a
+ * second
+ */
+sf::Socket::Status sendPacket(Transport &transport, const sf::Packet &packet);
+
+/**
+ * @brief The room of the server selected by the environment variable
+ * CYCLES_ROOM
+ *
+ * @return The index of the room, -1 to let the server choose
+ */
+sf::Int32 getRequestedRoom();
+
+/**
+ * @brief Create the first message of a spectator, sent instead of the name
+ * of the player
+ *
+ * @param room The room to watch, -1 for the first one
+ */
+sf::Packet makeObserverRequest(sf::Uint32 frameInterval, sf::Int32 room = -1);
+
+/**
+ * @brief Check if the first message of a client comes from a spectator
+ *
+ * @param message The first message of the client
+ * @param frameInterval Set to the interval requested by the spectator
+ * @param room Set to the room requested by the spectator, -1 if any
+ */
+bool isObserverRequest(std::span<const char> message,
+                       sf::Uint32 &frameInterval, sf::Int32 &room);
+} // namespace detail
+
 } // namespace cycles
+
+/**
+ * @brief Define the entry point of a bot
+ *
+ * botMain has the signature of main. Bots compiled as executables get a main
+ * that calls it. Bots compiled as shared libraries with CYCLES_BOT_MODULE
+ * defined export cycles_bot_main instead, which the server calls in its own
+ * thread to run the bot in process. The connections created by botMain then
+ * reach the server through memory, the code of the bot does not change.
+ */
+#ifdef CYCLES_BOT_MODULE
+#ifdef _WIN32
+#define CYCLES_BOT_EXPORT __declspec(dllexport)
+#else
+#define CYCLES_BOT_EXPORT __attribute__((visibility("default")))
+#endif
+#define CYCLES_BOT_MAIN(botMain)                                               \
+  extern "C" CYCLES_BOT_EXPORT int cycles_bot_main(                            \
+      std::shared_ptr<cycles::Transport> *transport, int argc, char *argv[]) { \
+    cycles::detail::setDefaultTransport(*transport);                           \
+    return botMain(argc, argv);                                                \
+  }
+#else
+#define CYCLES_BOT_MAIN(botMain)                                               \
+  int main(int argc, char *argv[]) { return botMain(argc, argv); }
+#endif
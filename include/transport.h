@@ -0,0 +1,544 @@
+#pragma once
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace cycles {
+
+/**
+ * @brief Counters of the messages sent through a transport, to spot the
+ * other side lagging behind
+ */
+struct TransportStatistics {
+  std::uint64_t messagesSent = 0; ///< Messages handed to the other side
+  /// Messages given to sendLatest that were replaced by a newer one or lost
+  std::uint64_t messagesDropped = 0;
+  std::size_t queuedBytes = 0; ///< Bytes waiting to be sent
+};
+
+/**
+ * @brief A message oriented link between the server and a client
+ *
+ * Messages are the contents of an sf::Packet. No method blocks, except wait
+ * and the receive overload with a timeout.
+ */
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  /**
+   * @brief Queue a message to be sent
+   *
+   * @return sf::Socket::Done if the message was accepted, sf::Socket::NotReady
+   * if there is no room for it until some of the queued messages are sent
+   * (see flush), an error otherwise
+   */
+  virtual sf::Socket::Status send(const sf::Packet &packet) = 0;
+
+  /**
+   * @brief Queue a message that will not be modified anymore
+   *
+   * Transports that can hand the message to the other side without copying
+   * it override this.
+   */
+  virtual sf::Socket::Status send(std::shared_ptr<const sf::Packet> packet) {
+    return send(*packet);
+  }
+
+  /**
+   * @brief Queue a message that makes the previous ones sent this way
+   * obsolete, such as the game state of a new frame
+   *
+   * Transports may drop such a message if a newer one is sent before it is
+   * received, or if it is lost. By default it is sent as any other message.
+   */
+  virtual sf::Socket::Status
+  sendLatest(std::shared_ptr<const sf::Packet> packet) {
+    return send(packet);
+  }
+
+  /**
+   * @brief Try to send the rest of the queued messages
+   *
+   * @return sf::Socket::Done if there is nothing left to send
+   */
+  virtual sf::Socket::Status flush() { return sf::Socket::Done; }
+
+  /**
+   * @brief Receive a message if it is complete
+   *
+   * @param message Set to the contents of the message, which stay valid until
+   * the next call to receive
+   * @return sf::Socket::Done if a message was received, sf::Socket::NotReady
+   * if there is none yet, an error otherwise
+   */
+  virtual sf::Socket::Status receive(std::span<const char> &message) = 0;
+
+  /**
+   * @brief Receive a message, waiting for at most the given amount of time
+   */
+  sf::Socket::Status receive(std::span<const char> &message, sf::Time timeout);
+
+  /**
+   * @brief Wait until there is new data to receive
+   *
+   * @param timeout The maximum time to wait, sf::Time::Zero to wait forever
+   * @return true if there is new data
+   */
+  virtual bool wait(sf::Time timeout) = 0;
+
+  /**
+   * @brief The socket that becomes ready when there is data to receive
+   *
+   * Allows to wait for several transports at once with an
+   * sf::SocketSelector.
+   *
+   * @return The socket, nullptr if the transport cannot be waited on this
+   * way
+   */
+  virtual sf::Socket *getWaitableSocket() { return nullptr; }
+
+  /**
+   * @brief Check if the other side is still connected
+   */
+  virtual bool isConnected() const = 0;
+
+  /**
+   * @brief Close the link, the other side will see it disconnected
+   */
+  virtual void disconnect() = 0;
+
+  /**
+   * @brief The counters of the messages sent so far
+   */
+  const TransportStatistics &getStatistics() const { return statistics; }
+
+protected:
+  TransportStatistics statistics;
+};
+
+namespace detail {
+// The bytes of the messages that can wait to be sent by a TcpTransport
+constexpr std::size_t defaultMaxQueuedBytes = 4 << 20;
+// The largest message accepted from the server, enough for the state of a
+// 16384x16384 grid
+constexpr std::size_t maxStateSize = std::size_t(1) << 28;
+// The largest message accepted from a client. Clients only send their name,
+// their moves and requests
+constexpr std::size_t maxClientMessageSize = std::size_t(1) << 16;
+
+/**
+ * @brief Incrementally receives the packets sent with
+ * sf::TcpSocket::send(sf::Packet&) from a non-blocking socket
+ */
+class FrameReceiver {
+  char header[4];
+  std::size_t received = 0; // Including the header
+  std::vector<char> frame;
+  std::size_t maxSize;
+
+public:
+  /**
+   * @param maxSize The largest packet accepted, the size comes from the peer
+   */
+  explicit FrameReceiver(std::size_t maxSize) : maxSize(maxSize) {}
+
+  /**
+   * @brief Read all the available data, up to the end of the current packet
+   *
+   * @return sf::Socket::Done if the packet is complete, sf::Socket::Error if
+   * it is larger than the maximum, the status of the socket otherwise
+   */
+  sf::Socket::Status receive(sf::TcpSocket &socket);
+
+  /**
+   * @brief The contents of the last complete packet
+   */
+  const std::vector<char> &getFrame() const { return frame; }
+};
+} // namespace detail
+
+/**
+ * @brief A transport over a TCP socket
+ *
+ * Uses the same framing as sf::TcpSocket::send(sf::Packet&), so the other
+ * side can use plain SFML packets. The socket is made non-blocking.
+ *
+ * Messages that cannot be sent right away are queued, up to a maximum
+ * number of bytes. A message given to sendLatest replaces the ones given to
+ * sendLatest that are still waiting in the queue, so a slow receiver only
+ * gets the newest state.
+ */
+class TcpTransport : public Transport {
+  struct QueuedMessage {
+    std::shared_ptr<const sf::Packet> packet;
+    bool latest;
+  };
+
+  std::shared_ptr<sf::TcpSocket> socket;
+  sf::SocketSelector selector;
+  detail::FrameReceiver receiver;
+  std::deque<QueuedMessage> queue; // Waiting behind the message being sent
+  std::size_t maxQueuedBytes;
+  // The message being sent. Shared messages are sent straight from the
+  // packet, the rest are copied to sendBuffer, which is reused so that
+  // sending does not allocate
+  std::shared_ptr<const sf::Packet> sharedMessage;
+  std::vector<char> sendBuffer;
+  const char *sendData = nullptr;
+  std::size_t sendSize = 0;
+  char sendHeader[4];
+  std::size_t sent = 0; // Including the header
+  bool sending = false;
+  bool connected = true;
+
+  void beginMessage(const char *data, std::size_t size);
+  sf::Socket::Status startSending();
+  sf::Socket::Status enqueue(std::shared_ptr<const sf::Packet> packet,
+                             bool latest);
+
+public:
+  /**
+   * @brief Construct a new transport from a connected socket
+   *
+   * @param socket The socket, which can also be still connecting without
+   * blocking
+   * @param maxQueuedBytes The maximum size of the messages waiting to be
+   * sent
+   * @param maxMessageSize The largest message accepted from the other side,
+   * which is disconnected if it sends a larger one
+   */
+  TcpTransport(std::shared_ptr<sf::TcpSocket> socket,
+               std::size_t maxQueuedBytes = detail::defaultMaxQueuedBytes,
+               std::size_t maxMessageSize = detail::maxStateSize);
+
+  using Transport::receive;
+  sf::Socket::Status send(const sf::Packet &packet) override;
+  sf::Socket::Status send(std::shared_ptr<const sf::Packet> packet) override;
+  sf::Socket::Status
+  sendLatest(std::shared_ptr<const sf::Packet> packet) override;
+  sf::Socket::Status flush() override;
+  sf::Socket::Status receive(std::span<const char> &message) override;
+  bool wait(sf::Time timeout) override;
+  sf::Socket *getWaitableSocket() override { return socket.get(); }
+  bool isConnected() const override;
+  void disconnect() override;
+
+  /**
+   * @brief The handle of the socket in the operating system, to wait on many
+   * transports at once with poll or similar
+   */
+  sf::SocketHandle getNativeHandle() const;
+};
+
+namespace detail {
+// One direction of an in-process link
+struct InProcessChannel {
+  std::mutex mutex;
+  std::condition_variable condition;
+  // Whether each message was given to sendLatest
+  std::deque<std::pair<std::shared_ptr<const sf::Packet>, bool>> messages;
+  bool closed = false;
+};
+} // namespace detail
+
+/**
+ * @brief A transport between two threads of the same process
+ *
+ * Messages are passed by pointer, a message shared with several clients is
+ * never copied nor goes through the network stack. A message given to
+ * sendLatest replaces the ones given to sendLatest that were not received
+ * yet. As with a socket, the messages sent before the other side
+ * disconnected can still be received, and the transport is connected until
+ * then.
+ */
+class InProcessTransport : public Transport {
+  std::shared_ptr<detail::InProcessChannel> incoming;
+  std::shared_ptr<detail::InProcessChannel> outgoing;
+  std::shared_ptr<const sf::Packet> current; // The last received message
+  std::atomic<bool> disconnected = false;     // By this side
+
+  sf::Socket::Status push(std::shared_ptr<const sf::Packet> packet,
+                          bool latest);
+
+public:
+  InProcessTransport(std::shared_ptr<detail::InProcessChannel> incoming,
+                     std::shared_ptr<detail::InProcessChannel> outgoing)
+      : incoming(incoming), outgoing(outgoing) {}
+
+  ~InProcessTransport() override { disconnect(); }
+
+  using Transport::receive;
+  sf::Socket::Status send(const sf::Packet &packet) override;
+  sf::Socket::Status send(std::shared_ptr<const sf::Packet> packet) override;
+  sf::Socket::Status
+  sendLatest(std::shared_ptr<const sf::Packet> packet) override;
+  sf::Socket::Status receive(std::span<const char> &message) override;
+  bool wait(sf::Time timeout) override;
+  bool isConnected() const override;
+  void disconnect() override;
+};
+
+/**
+ * @brief Create the two ends of an in-process link
+ */
+std::pair<std::shared_ptr<Transport>, std::shared_ptr<Transport>>
+makeInProcessTransportPair();
+
+/**
+ * @brief A transport that sends the messages given to sendLatest as UDP
+ * datagrams, and everything else through TCP
+ *
+ * A lost or late state does not hold back the following ones as it would in
+ * TCP. Each message is numbered and split in datagrams small enough to not be
+ * fragmented by the network, the receiver only delivers messages newer than
+ * the last one it delivered. Most messages are sent as the difference with a
+ * keyframe, a full message the receiver has acknowledged. The last message is
+ * repeated by flush until it is acknowledged.
+ *
+ * Clients use it when the environment variable CYCLES_TRANSPORT is set to
+ * "udp".
+ */
+class UdpTransport : public Transport {
+  TcpTransport control;
+  sf::UdpSocket udp;
+  sf::SocketSelector selector;
+  sf::IpAddress peerAddress;
+  unsigned short peerPort = 0; // 0 until the peer is known
+  // The server replies to the request with its port and this token, the
+  // client repeats it in hello datagrams until the server answers. The server
+  // sends to wherever the first valid hello came from, so it works behind NAT
+  const bool isClient;
+  sf::Uint64 token = 0;
+  bool helloAnswered = false;
+  sf::Clock helloClock;
+  // The datagrams of the last message, sent in a single batch
+  std::vector<char> datagrams;
+  std::vector<std::size_t> datagramSizes;
+#ifdef __linux__
+  // What sendmmsg is given, reused to not allocate it in every send
+  sockaddr_in peerSocketAddress{};
+  std::vector<iovec> datagramParts;
+  std::vector<mmsghdr> datagramHeaders;
+#endif
+  float simulatedLoss = 0;
+  std::mt19937 random;
+  // Sender
+  sf::Uint32 lastSequence = 0;
+  std::vector<char> keyframe;
+  sf::Uint32 keyframeSequence = 0;
+  bool keyframeAcknowledged = false;
+  int framesSinceKeyframe = 0;
+  std::vector<char> encoded; // The last message, as sent
+  sf::Uint32 encodedBase = 0;
+  bool acknowledged = true;
+  sf::Clock repeatClock;
+  // Receiver
+  std::vector<char> assembly; // The message being reassembled
+  sf::Uint32 assemblySequence = 0;
+  sf::Uint32 assemblyBase = 0;
+  std::vector<bool> fragmentsReceived;
+  std::size_t fragmentsMissing = 0;
+  std::vector<char> receivedKeyframe;
+  sf::Uint32 receivedKeyframeSequence = 0;
+  std::vector<char> decoded; // The newest complete message
+  std::vector<char> frame;   // The last delivered message
+  sf::Uint32 readySequence = 0;
+  sf::Uint32 readyBase = 0;
+  sf::Uint32 deliveredSequence = 0;
+
+  UdpTransport(std::shared_ptr<sf::TcpSocket> socket, bool isClient);
+
+  bool processReply(std::span<const char> message);
+  void sendHello();
+  void processHello(const char *data, sf::IpAddress address,
+                    unsigned short port);
+  void sendDatagrams();
+  void sendDatagram(const char *data, std::size_t size);
+  bool isLost();
+  void sendAcknowledgement(sf::Uint32 sequence, sf::Uint32 base);
+  void receiveDatagrams();
+  void processFragment(const char *data, std::size_t size);
+  void processAcknowledgement(const char *data, std::size_t size);
+  bool decodeAssembly();
+
+public:
+  /**
+   * @brief Open a UDP port and ask the server to send the states there
+   *
+   * The reply of the server is the first message received through the
+   * socket, receive handles it.
+   *
+   * @param socket A socket connected to the server
+   * @return The transport, nullptr if the request could not be sent
+   */
+  static std::shared_ptr<UdpTransport>
+  connect(std::shared_ptr<sf::TcpSocket> socket);
+
+  /**
+   * @brief Check if the first message sent by a client is the request sent
+   * by connect
+   */
+  static bool isAttachRequest(std::span<const char> message);
+
+  /**
+   * @brief Start sending the states of a client through UDP
+   *
+   * The states are held back until the first hello datagram of the client
+   * tells where to send them.
+   *
+   * @param socket The socket the request was received from
+   * @param message The request
+   * @return The transport, nullptr if the request is not valid or the reply
+   * could not be sent
+   */
+  static std::shared_ptr<UdpTransport>
+  accept(std::shared_ptr<sf::TcpSocket> socket, std::span<const char> message);
+
+  /**
+   * @brief Drop the given fraction of the outgoing datagrams, to test the
+   * behaviour under packet loss
+   *
+   * The same seed drops the same datagrams of the same sequence of sends.
+   */
+  void setSimulatedLoss(float probability, std::uint32_t seed = 1) {
+    simulatedLoss = probability;
+    random.seed(seed);
+  }
+
+  using Transport::receive;
+  using Transport::send;
+  sf::Socket::Status send(const sf::Packet &packet) override;
+  sf::Socket::Status
+  sendLatest(std::shared_ptr<const sf::Packet> packet) override;
+  sf::Socket::Status flush() override;
+  sf::Socket::Status receive(std::span<const char> &message) override;
+  bool wait(sf::Time timeout) override;
+  sf::Socket *getWaitableSocket() override {
+    return control.getWaitableSocket();
+  }
+  bool isConnected() const override;
+  void disconnect() override;
+};
+
+#ifndef _WIN32
+namespace detail {
+// A single producer, single consumer queue of messages in shared memory.
+// Positions only grow, the offset in the buffer is position % capacity
+struct alignas(64) ShmRing {
+  std::atomic<std::uint64_t> head; // Written by the producer
+  alignas(64) std::atomic<std::uint64_t> tail; // Written by the consumer
+  alignas(64) std::atomic<std::uint32_t> signal; // Futex word, bumped per message
+  std::atomic<std::uint32_t> waiting; // Consumers waiting on signal
+  // Set by the client, which can still change them afterwards, so the server
+  // reads them once when attaching
+  std::atomic<std::uint64_t> capacity;
+  std::atomic<std::uint64_t> offset; // Of the buffer, from the start of the segment
+};
+
+// The beginning of the shared memory segment
+struct ShmHeader {
+  std::atomic<std::uint32_t> magic;
+  std::uint32_t version;
+  std::atomic<std::uint32_t> closed;
+  ShmRing toClient;
+  ShmRing toServer;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must be lock free");
+} // namespace detail
+
+/**
+ * @brief A transport through shared memory, for clients running in the same
+ * host as the server
+ *
+ * The client creates a segment in /dev/shm with a ring of messages in each
+ * direction, and asks the server to use it through the TCP connection, which
+ * is then only used to detect disconnections. Sending a message is a single
+ * copy into the ring, receiving returns a view of the message inside the
+ * ring, no system calls are made unless the receiver is waiting. As with a
+ * socket, the messages sent before the other side disconnected can still be
+ * received, and the transport is connected until then.
+ *
+ * Clients use it when the environment variable CYCLES_TRANSPORT is set to
+ * "shm".
+ */
+class ShmTransport : public Transport {
+  std::shared_ptr<sf::TcpSocket> socket;
+  void *memory;
+  std::size_t memorySize;
+  std::string segmentName;
+  bool isServer;
+  detail::ShmRing *incoming;
+  detail::ShmRing *outgoing;
+  // The buffers of the rings, nullptr if the header places them outside the
+  // segment. Never read from the header again
+  char *incomingBuffer = nullptr;
+  std::uint64_t incomingCapacity = 0;
+  char *outgoingBuffer = nullptr;
+  std::uint64_t outgoingCapacity = 0;
+  std::uint64_t readPosition; // The end of the last received message
+  sf::Clock socketCheckClock;
+  bool connected = true;
+  bool disconnected = false; // By this side
+
+  ShmTransport(std::shared_ptr<sf::TcpSocket> socket, void *memory,
+               std::size_t memorySize, std::string segmentName, bool isServer);
+
+  void checkSocket();
+  bool isLinked() const;
+
+public:
+  /**
+   * @brief Create a shared memory segment and ask the server to use it
+   *
+   * @param socket A blocking socket connected to the server
+   * @return The transport, nullptr if the segment could not be created
+   */
+  static std::shared_ptr<ShmTransport>
+  connect(std::shared_ptr<sf::TcpSocket> socket);
+
+  /**
+   * @brief Check if the first message sent by a client is the request sent
+   * by connect
+   */
+  static bool isAttachRequest(std::span<const char> message);
+
+  /**
+   * @brief Attach the server to the segment of a client
+   *
+   * @param socket The socket the request was received from
+   * @param message The request
+   * @return The transport, nullptr if the segment could not be used
+   */
+  static std::shared_ptr<ShmTransport>
+  accept(std::shared_ptr<sf::TcpSocket> socket, std::span<const char> message);
+
+  ~ShmTransport() override;
+
+  using Transport::receive;
+  sf::Socket::Status send(const sf::Packet &packet) override;
+  sf::Socket::Status receive(std::span<const char> &message) override;
+  bool wait(sf::Time timeout) override;
+  bool isConnected() const override;
+  void disconnect() override;
+};
+#endif
+
+} // namespace cycles
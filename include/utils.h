@@ -30,4 +30,11 @@ namespace cycles{
    */
   sf::Vector2i getDirectionVector(Direction direction);
 
+  /**
+   * @brief Microseconds elapsed in a monotonic clock.
+   *
+   * The server uses it to timestamp the messages it sends to the clients.
+   */
+  sf::Int64 getMonotonicTime();
+
 }
@@ -11,18 +11,10 @@ vec3 jodieReinhardTonemap(vec3 c){
     return mix(c / (l + 1.0), tc, tc);
 }
 
-vec3 bloomTile(float lod, vec2 offset, vec2 uv){
-    return texture(iChannel1, uv * exp2(-lod) + offset).rgb;
-}
-
+// iChannel1 is the bloom pyramid added up in its first level, at half the
+// resolution and in linear colours
 vec3 getBloom(vec2 uv){
-    vec3 blur = vec3(0.0);
-    blur += pow(bloomTile(2., vec2(0.0,0.0), uv),vec3(2.2));
-    //blur += pow(bloomTile(3., vec2(0.3,0.0), uv),vec3(2.2)) * 1.3;
-    //blur += pow(bloomTile(4., vec2(0.0,0.3), uv),vec3(2.2)) * 1.6;
-    // blur += pow(bloomTile(5., vec2(0.1,0.3), uv),vec3(2.2)) * 1.9;
-    //blur += pow(bloomTile(6., vec2(0.2,0.3), uv),vec3(2.2)) * 2.2;
-    return blur * colorRange;
+    return texture(iChannel1, uv).rgb * colorRange;
 }
 
 void main(){
@@ -0,0 +1,28 @@
+// Halves the resolution of a level of the bloom pyramid, blurring it with
+// five bilinear taps. The first level leaves white out of the bloom and makes
+// the colours linear, scaled so that the levels added together fit in a byte
+uniform sampler2D source;
+uniform vec2 texelSize; // Of the source
+uniform bool prefilter;
+uniform float scale;
+
+vec3 fetch(vec2 coord) {
+  vec3 color = texture2D(source, coord).rgb;
+  if (prefilter) {
+    if (all(equal(color, vec3(1.0)))) {
+      return vec3(0.0);
+    }
+    color = pow(color, vec3(2.2));
+  }
+  return color;
+}
+
+void main() {
+  vec2 coord = gl_TexCoord[0].xy;
+  vec3 sum = fetch(coord) * 4.0;
+  sum += fetch(coord - texelSize);
+  sum += fetch(coord + texelSize);
+  sum += fetch(coord + vec2(texelSize.x, -texelSize.y));
+  sum += fetch(coord - vec2(texelSize.x, -texelSize.y));
+  gl_FragColor = vec4(sum / 8.0 * scale, 1.0);
+}
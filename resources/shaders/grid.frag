@@ -0,0 +1,21 @@
+// Colours the grid, uploaded with the ids of four cells in each texel, with
+// the colours of the players
+uniform sampler2D grid;
+uniform sampler2D palette; // 256x1, one texel for each id
+
+void main() {
+  // SFML divides the texture coordinates by the real size of the texture,
+  // which is padded to powers of two where they are required
+  vec2 textureSize = 1.0 / abs(vec2(gl_TextureMatrix[0][0][0],
+                                    gl_TextureMatrix[0][1][1]));
+  vec2 cell = floor(gl_TexCoord[0].xy * vec2(textureSize.x * 4.0, textureSize.y));
+  float texel = floor(cell.x / 4.0);
+  float channel = cell.x - texel * 4.0;
+  vec4 cells = texture2D(grid, (vec2(texel, cell.y) + 0.5) / textureSize);
+  float id = channel < 0.5 ? cells.r
+           : channel < 1.5 ? cells.g
+           : channel < 2.5 ? cells.b
+                           : cells.a;
+  gl_FragColor =
+      gl_Color * texture2D(palette, vec2((id * 255.0 + 0.5) / 256.0, 0.5));
+}
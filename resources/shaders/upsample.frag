@@ -0,0 +1,18 @@
+// Doubles the resolution of a level of the bloom pyramid with a tent filter,
+// it is added to the level above with the given weight
+uniform sampler2D source;
+uniform vec2 texelSize; // Of the source
+uniform float weight;
+
+void main() {
+  vec2 coord = gl_TexCoord[0].xy;
+  vec3 sum = texture2D(source, coord + vec2(-texelSize.x, 0.0)).rgb;
+  sum += texture2D(source, coord + vec2(texelSize.x, 0.0)).rgb;
+  sum += texture2D(source, coord + vec2(0.0, -texelSize.y)).rgb;
+  sum += texture2D(source, coord + vec2(0.0, texelSize.y)).rgb;
+  sum += texture2D(source, coord + texelSize * 0.5).rgb * 2.0;
+  sum += texture2D(source, coord - texelSize * 0.5).rgb * 2.0;
+  sum += texture2D(source, coord + vec2(texelSize.x, -texelSize.y) * 0.5).rgb * 2.0;
+  sum += texture2D(source, coord - vec2(texelSize.x, -texelSize.y) * 0.5).rgb * 2.0;
+  gl_FragColor = vec4(sum / 12.0 * weight, 1.0);
+}
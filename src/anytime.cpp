@@ -0,0 +1,95 @@
+#include "anytime.h"
+#include <algorithm>
+#include <chrono>
+#include <spdlog/spdlog.h>
+
+namespace cycles {
+
+namespace detail {
+// Any move that does not crash right away, used when the search does not
+// publish one in time
+Direction findSafeMove(const GameState &state, const Player &player) {
+  for (int i = 0; i < 4; ++i) {
+    auto direction = getDirectionFromValue(i);
+    auto position = player.position + getDirectionVector(direction);
+    if (state.isInsideGrid(position) && state.isInsideWindow(position) &&
+        state.isCellEmpty(position)) {
+      return direction;
+    }
+  }
+  return Direction::north;
+}
+} // namespace detail
+
+AnytimeHarness::AnytimeHarness(Connection &connection, std::string playerName,
+                               Search search, sf::Time safetyMargin)
+    : connection(connection), playerName(playerName), search(search),
+      safetyMargin(safetyMargin), worker(&AnytimeHarness::workerLoop, this) {}
+
+AnytimeHarness::~AnytimeHarness() {
+  {
+    std::scoped_lock lock(mutex);
+    finished = true;
+  }
+  condition.notify_all();
+  worker.join();
+}
+
+void AnytimeHarness::workerLoop() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    condition.wait(lock, [this] { return searching || finished; });
+    if (finished) {
+      return;
+    }
+    lock.unlock();
+    search(*context);
+    lock.lock();
+    searching = false;
+    condition.notify_all();
+  }
+}
+
+void AnytimeHarness::playFrame(const Player &player) {
+  SearchContext frameContext(state, player, connection,
+                             detail::findSafeMove(state, player));
+  std::unique_lock lock(mutex);
+  context = &frameContext;
+  searching = true;
+  condition.notify_all();
+  // Wait until the search is done or the deadline is close
+  const auto budget = connection.getRemainingTime() - safetyMargin;
+  condition.wait_for(lock, std::chrono::microseconds(budget.asMicroseconds()),
+                     [this] { return !searching; });
+  frameContext.stop = true;
+  lock.unlock();
+  connection.sendMove(getDirectionFromValue(frameContext.bestMove));
+  if (connection.getRemainingTime() < sf::Time::Zero) {
+    spdlog::warn("{}: Move for frame {} sent after the deadline", playerName,
+                 state.frameNumber);
+  }
+  // The state cannot be overwritten while the search still reads it
+  lock.lock();
+  condition.wait(lock, [this] { return !searching; });
+  context = nullptr;
+}
+
+void AnytimeHarness::run() {
+  while (connection.isActive()) {
+    connection.receiveGameState(state);
+    if (!connection.isActive()) {
+      break;
+    }
+    auto player = std::find_if(
+        state.players.begin(), state.players.end(),
+        [this](const Player &player) { return player.name == playerName; });
+    if (player == state.players.end()) {
+      spdlog::warn("{}: Player not found in frame {}", playerName,
+                   state.frameNumber);
+      continue;
+    }
+    playFrame(*player);
+  }
+}
+
+} // namespace cycles
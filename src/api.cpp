@@ -1,35 +1,145 @@
 #include "api.h"
 #include <SFML/Network.hpp>
+#include <algorithm>
+#include <cstring>
 #include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <thread>
+#include <utility>
 
 namespace cycles {
 
-GameState::GameState(sf::Packet &packet) {
-  packet >> gridWidth >> gridHeight;
-  sf::Uint32 playerCount;
-  packet >> playerCount;
+namespace detail {
+
+// Reads values encoded by sf::Packet directly from a buffer, so the grid can be
+// copied out of the received frame without going through sf::Packet
+class FrameReader {
+  const char *data;
+  std::size_t size;
+  std::size_t position = 0;
+  bool valid = true;
+
+  bool checkSize(std::size_t count) {
+    valid = valid && position + count <= size;
+    return valid;
+  }
+
+public:
+  FrameReader(const char *data, std::size_t size) : data(data), size(size) {}
+
+  FrameReader &operator>>(sf::Uint8 &value) {
+    if (checkSize(1)) {
+      value = static_cast<sf::Uint8>(data[position++]);
+    }
+    return *this;
+  }
+
+  FrameReader &operator>>(sf::Uint32 &value) {
+    // sf::Packet stores integers in network byte order
+    if (checkSize(4)) {
+      const auto *bytes = reinterpret_cast<const unsigned char *>(data + position);
+      value = (sf::Uint32(bytes[0]) << 24) | (sf::Uint32(bytes[1]) << 16) |
+              (sf::Uint32(bytes[2]) << 8) | sf::Uint32(bytes[3]);
+      position += 4;
+    }
+    return *this;
+  }
+
+  FrameReader &operator>>(sf::Int32 &value) {
+    sf::Uint32 bits = 0;
+    *this >> bits;
+    value = static_cast<sf::Int32>(bits);
+    return *this;
+  }
+
+  FrameReader &operator>>(sf::Int64 &value) {
+    sf::Uint32 high = 0, low = 0;
+    *this >> high >> low;
+    value = static_cast<sf::Int64>((sf::Uint64(high) << 32) | low);
+    return *this;
+  }
+
+  // Reuses the capacity of the string
+  FrameReader &operator>>(std::string &value) {
+    sf::Uint32 length = 0;
+    *this >> length;
+    if (checkSize(length)) {
+      value.assign(data + position, length);
+      position += length;
+    }
+    return *this;
+  }
+
+  // Returns a pointer to the next count bytes, or nullptr if there are not
+  // enough of them
+  const char *read(std::size_t count) {
+    if (!checkSize(count)) {
+      return nullptr;
+    }
+    const char *begin = data + position;
+    position += count;
+    return begin;
+  }
+
+  std::size_t remaining() const { return valid ? size - position : 0; }
+
+  explicit operator bool() const { return valid; }
+
+  bool endOfFrame() const { return position == size; }
+};
+
+} // namespace detail
+
+bool GameState::update(const char *data, std::size_t size) {
+  detail::FrameReader frame(data, size);
+  frame >> gridWidth >> gridHeight;
+  sf::Uint32 playerCount = 0;
+  frame >> playerCount;
+  // The counts come from the peer, so they are checked against the bytes
+  // left before anything is allocated for them. A player takes at least its
+  // position, color, name length, id and frame
+  constexpr std::size_t minPlayerBytes = 4 + 4 + 3 + 4 + 1 + 4;
+  if (!frame || playerCount > frame.remaining() / minPlayerBytes) {
+    return false;
+  }
+  // Resizing and assigning in place keeps the capacity of the vectors and
+  // strings from the previous frame
   players.resize(playerCount);
-  for (sf::Uint32 i = 0; i < playerCount; ++i) {
-    int x, y;
+  for (auto &player : players) {
     sf::Uint8 r, g, b;
-    Id playerId;
-    std::string playerName;
-    packet >> x >> y >> r >> g >> b >> playerName >> playerId >> frameNumber;
-    players[i] = {playerName, sf::Color(r, g, b), sf::Vector2i(x, y), playerId};
-  }
-  grid.resize(gridWidth * gridHeight);
-  for (auto &cell : grid) {
-    packet >> cell;
-  }
-  //Check that the whole packet was read
-  if (!packet.endOfPacket()) {
-    spdlog::critical("There is still data left in the packet");
-    exit(1);
+    frame >> player.position.x >> player.position.y >> r >> g >> b >>
+        player.name >> player.id >> frameNumber;
+    player.color = sf::Color(r, g, b);
+  }
+  frame >> sendTime >> moveDeadline;
+  frame >> windowX >> windowY >> windowWidth >> windowHeight;
+  if (!frame || windowWidth < 0 || windowHeight < 0) {
+    return false;
+  }
+  // The grid is the rest of the frame
+  const std::size_t cellCount = static_cast<std::size_t>(windowWidth) *
+                                static_cast<std::size_t>(windowHeight);
+  if (cellCount != frame.remaining()) {
+    return false;
+  }
+  grid.resize(cellCount);
+  const char *cells = frame.read(grid.size());
+  if (cells != nullptr && !grid.empty()) {
+    std::memcpy(grid.data(), cells, grid.size());
   }
+  //Check that the whole packet was read, and nothing more
+  return frame && frame.endOfFrame();
 }
 
 namespace detail {
-std::shared_ptr<sf::TcpSocket> establishLink() {
+thread_local std::shared_ptr<Transport> defaultTransport;
+constexpr auto observerRequestTag = "cycles-observer";
+
+void setDefaultTransport(std::shared_ptr<Transport> transport) {
+  defaultTransport = transport;
+}
+
+std::shared_ptr<Transport> establishLink() {
   spdlog::debug("Trying to connect");
   auto socket = std::make_shared<sf::TcpSocket>();
   const char *port = std::getenv("CYCLES_PORT");
@@ -41,109 +151,275 @@ std::shared_ptr<sf::TcpSocket> establishLink() {
   spdlog::info("Connecting to server at {}:{}", SERVER_IP, SERVER_PORT);
   if (socket->connect(SERVER_IP, SERVER_PORT) != sf::Socket::Done) {
     spdlog::critical("Failed to connect to server");
-    exit(1);
+    return nullptr;
+  }
+  const char *transport = std::getenv("CYCLES_TRANSPORT");
+  if (transport != nullptr && std::string(transport) == "udp") {
+    return UdpTransport::connect(socket);
+  }
+#ifndef _WIN32
+  // The server runs in the same host, the connection only tells if it is
+  // still alive
+  if (transport != nullptr && std::string(transport) == "shm") {
+    return ShmTransport::connect(socket);
   }
-  return socket;
+#endif
+  return std::make_shared<TcpTransport>(socket);
 }
 
-void sendPacket(std::shared_ptr<sf::TcpSocket> socket, sf::Packet &packet,
-                bool blocking = true) {
-  int attempts = 0;
-  bool blockingState = socket->isBlocking();
-  socket->setBlocking(blocking);
-  auto status = sf::Socket::NotReady;
-  while (status != sf::Socket::Done && attempts < 10) {
-    status = socket->send(packet);
-    if (status == sf::Socket::NotReady) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    attempts++;
+// Queues the packet and waits until it is completely sent. A move is so small
+// that it practically always goes out at the first attempt
+sf::Socket::Status sendPacket(Transport &transport, const sf::Packet &packet) {
+  const auto timeout = sf::seconds(1);
+  sf::Clock clock;
+  auto status = transport.send(packet);
+  while (status == sf::Socket::NotReady && clock.getElapsedTime() < timeout) {
+    std::this_thread::yield();
+    status = transport.send(packet);
   }
   if (status != sf::Socket::Done) {
-    spdlog::critical("Failed to send packet to server");
-    spdlog::critical("Reason: {}", socketErrorToString(status));
-    exit(1);
+    return status;
+  }
+  status = transport.flush();
+  while (status == sf::Socket::NotReady && clock.getElapsedTime() < timeout) {
+    std::this_thread::yield();
+    status = transport.flush();
   }
-  socket->setBlocking(blockingState);
+  return status;
 }
 
-sf::Packet receivePacket(std::shared_ptr<sf::TcpSocket> socket,
-                         bool blocking = true) {
+sf::Int32 getRequestedRoom() {
+  const char *room = std::getenv("CYCLES_ROOM");
+  if (room == nullptr) {
+    return -1;
+  }
+  return std::stoi(room);
+}
+
+sf::Packet makeObserverRequest(sf::Uint32 frameInterval, sf::Int32 room) {
+  sf::Packet request;
+  request << observerRequestTag << std::max<sf::Uint32>(frameInterval, 1)
+          << room;
+  return request;
+}
+
+bool isObserverRequest(std::span<const char> message,
+                       sf::Uint32 &frameInterval, sf::Int32 &room) {
   sf::Packet packet;
-  bool blockingState = socket->isBlocking();
-  socket->setBlocking(blocking);
-  sf::Socket::Status status = sf::Socket::NotReady;
-  int attempts = 0;
-  while (status != sf::Socket::Done && attempts < 10) {
-    status = socket->receive(packet);
-    if (status == sf::Socket::NotReady) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  packet.append(message.data(), message.size());
+  std::string tag;
+  if (!(packet >> tag) || tag != observerRequestTag) {
+    return false;
+  }
+  frameInterval = 1;
+  packet >> frameInterval;
+  frameInterval = std::max<sf::Uint32>(frameInterval, 1);
+  // Optional, older spectators do not send it
+  room = -1;
+  packet >> room;
+  return true;
+}
+
+}; // namespace detail
+
+bool Connection::handshake(const sf::Packet &request, sf::Packet &reply) {
+  if (transport == nullptr) {
+    transport = std::exchange(detail::defaultTransport, nullptr);
+  }
+  requestTime = getMonotonicTime();
+  if (transport == nullptr) {
+    transport = detail::establishLink();
+    if (transport == nullptr) {
+      return false;
     }
-    attempts++;
   }
+  auto status = detail::sendPacket(*transport, request);
   if (status != sf::Socket::Done) {
-    spdlog::critical("Failed to receive packet from server");
-    spdlog::critical("Reason: {}", socketErrorToString(status));
-    exit(1);
+    disconnect(socketErrorToString(status));
+    return false;
+  }
+  std::span<const char> message;
+  status = transport->receive(message, sf::seconds(10));
+  if (status != sf::Socket::Done) {
+    disconnect(status == sf::Socket::NotReady ? "Handshake timed out"
+                                              : socketErrorToString(status));
+    return false;
   }
-  socket->setBlocking(blockingState);
-  return packet;
+  replyTime = getMonotonicTime();
+  reply.append(message.data(), message.size());
+  return true;
 }
 
-std::shared_ptr<sf::TcpSocket> connectToServer(std::string playerName) {
-  auto socket = detail::establishLink();
-  // Send name to server
-  sf::Packet namePacket;
-  namePacket << playerName;
-  detail::sendPacket(socket, namePacket);
-  return socket;
+void Connection::synchronizeClock(sf::Int64 serverTime) {
+  // The server stamped the reply somewhere between the request and the reply
+  roundTripTime = replyTime - requestTime;
+  clockOffset = serverTime - (requestTime + replyTime) / 2;
+  maxClockOffset = serverTime - requestTime;
+  spdlog::debug("{}: Round trip time {} us, clock offset {} us", playerName,
+                roundTripTime, clockOffset);
 }
 
-}; // namespace detail
-
-sf::Color Connection::connect(std::string playerName) {
-  this->playerName = playerName;
-  if (socket != nullptr) {
+sf::Color Connection::connect(std::string playerName, int viewRadius) {
+  if (!this->playerName.empty()) {
     spdlog::critical("Connection already established");
   }
-  socket = detail::connectToServer(playerName);
-  sf::Color color;
-  sf::Packet colorPacket = detail::receivePacket(socket);
+  this->playerName = playerName;
+  // Send name and observation mode to server
+  sf::Packet namePacket;
+  namePacket << playerName << static_cast<sf::Int32>(viewRadius)
+             << detail::getRequestedRoom();
+  sf::Packet colorPacket;
+  if (!handshake(namePacket, colorPacket)) {
+    return sf::Color();
+  }
   sf::Uint8 r, g, b;
   if (!(colorPacket >> r >> g >> b)) {
-    spdlog::critical("Failed to receive color from server");
-    exit(1);
+    disconnect("Failed to receive color from server");
+    return sf::Color();
   }
-  color = sf::Color(r, g, b);
+  sf::Color color(r, g, b);
   spdlog::info("{}: Assigned color: R={} G={} B={}", playerName,
                static_cast<int>(r), static_cast<int>(g), static_cast<int>(b));
+  sf::Int64 serverTime;
+  if (colorPacket >> serverTime) {
+    synchronizeClock(serverTime);
+  }
   return color;
 }
 
+bool Connection::observe(int frameInterval) {
+  if (!playerName.empty()) {
+    spdlog::critical("Connection already established");
+  }
+  playerName = "spectator";
+  observer = true;
+  sf::Packet reply;
+  if (!handshake(detail::makeObserverRequest(std::max(frameInterval, 1),
+                                             detail::getRequestedRoom()),
+                 reply)) {
+    return false;
+  }
+  sf::Int64 serverTime;
+  if (!(reply >> serverTime)) {
+    disconnect("The server does not accept spectators");
+    return false;
+  }
+  synchronizeClock(serverTime);
+  spdlog::info("Spectating one of every {} frames", frameInterval);
+  return true;
+}
+
+void Connection::disconnect(const std::string &reason) {
+  spdlog::error("{}: Connection to the server lost: {}", playerName, reason);
+  transport->disconnect();
+}
+
 void Connection::sendMove(Direction direction) {
+  if (observer) {
+    spdlog::warn("Spectators cannot send moves");
+    return;
+  }
   if (frameNumber == lastFrameSent) {
     spdlog::warn("Trying to send move twice in the same frame, call "
                  "receiveGameState first");
     return;
   }
+  if (!isActive()) {
+    return;
+  }
   spdlog::debug("Sending move");
-  sf::Packet packet;
-  packet << getDirectionValue(direction);
-  detail::sendPacket(socket, packet);
+  movePacket.clear();
+  movePacket << getDirectionValue(direction);
+  auto status = detail::sendPacket(*transport, movePacket);
+  if (status != sf::Socket::Done) {
+    disconnect(socketErrorToString(status));
+    return;
+  }
   lastFrameSent = frameNumber;
 }
 
 GameState Connection::receiveGameState() {
+  GameState state;
+  receiveGameState(state);
+  return state;
+}
+
+void Connection::receiveGameState(GameState &state) {
   spdlog::debug("Receiving game state");
-  auto packet = detail::receivePacket(socket);
-  GameState state(packet);
+  while (isActive() && !tryReceiveGameState(state)) {
+    transport->wait(sf::Time::Zero);
+  }
+}
+
+bool Connection::tryReceiveGameState(GameState &state) {
+  if (!isActive()) {
+    return false;
+  }
+  std::span<const char> frame;
+  auto status = transport->receive(frame);
+  if (status == sf::Socket::NotReady) {
+    return false;
+  }
+  if (status != sf::Socket::Done) {
+    disconnect(socketErrorToString(status));
+    return false;
+  }
+  const auto receiveTime = getMonotonicTime();
+  if (!state.update(frame.data(), frame.size())) {
+    disconnect("Received a malformed game state");
+    return false;
+  }
   frameNumber = state.frameNumber;
-  return state;
+  moveDeadline = state.moveDeadline;
+  // The state was sent before it was received, so this is a lower bound of
+  // the offset, which is tight whenever a state arrives quickly
+  const auto minClockOffset = state.sendTime - receiveTime;
+  if (minClockOffset > clockOffset) {
+    clockOffset = std::min(minClockOffset, maxClockOffset);
+  }
+  return true;
 }
 
-bool Connection::isActive() {
-  return socket->getRemoteAddress() != sf::IpAddress::None;
+sf::Time Connection::getRemainingTime() const {
+  if (moveDeadline == 0) {
+    return sf::Time::Zero;
+  }
+  const auto serverNow = getMonotonicTime() + clockOffset;
+  return sf::microseconds(moveDeadline - serverNow - roundTripTime / 2);
+}
+
+sf::Time Connection::getRoundTripTime() const {
+  return sf::microseconds(roundTripTime);
 }
 
+bool Connection::waitForGameState(GameState &state, sf::Time timeout) {
+  sf::Clock clock;
+  while (isActive()) {
+    if (tryReceiveGameState(state)) {
+      return true;
+    }
+    const auto remaining = timeout - clock.getElapsedTime();
+    if (remaining <= sf::Time::Zero) {
+      return false;
+    }
+    transport->wait(remaining);
+  }
+  return false;
+}
+
+std::future<GameState> Connection::receiveGameStateAsync() {
+  return std::async(std::launch::async, [this] {
+    GameState state;
+    receiveGameState(state);
+    if (!isActive()) {
+      throw std::runtime_error("Connection to the server lost");
+    }
+    return state;
+  });
+}
+
+bool Connection::isActive() {
+  return transport != nullptr && transport->isConnected();
+}
 
 } // namespace cycles
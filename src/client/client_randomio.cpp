@@ -40,9 +40,10 @@ class BotClient {
     Direction direction;
     do {
       if (attempts >= max_attempts) {
+        // Trapped, any move will do
         spdlog::error("{}: Failed to find a valid move after {} attempts", name,
                       max_attempts);
-        exit(1);
+        return direction;
       }
       // Simple random movement
       int proposal = dist(rng);
@@ -63,7 +64,7 @@ class BotClient {
   }
 
   void receiveGameState() {
-    state = connection.receiveGameState();
+    connection.receiveGameState(state);
     for (const auto &player : state.players) {
       if (player.name == name) {
         my_player = player;
@@ -80,37 +81,46 @@ class BotClient {
   }
 
 public:
-  BotClient(const std::string &botName) : name(botName) {
+  BotClient(const std::string &botName, int viewRadius = 0) : name(botName) {
     std::random_device rd;
     rng.seed(rd());
     std::uniform_int_distribution<int> dist(0, 50);
     inertia = dist(rng);
-    connection.connect(name);
-    if (!connection.isActive()) {
-      spdlog::critical("{}: Connection failed", name);
-      exit(1);
-    }
+    connection.connect(name, viewRadius);
   }
 
+  bool isConnected() { return connection.isActive(); }
+
   void run() {
     while (connection.isActive()) {
       receiveGameState();
+      if (!connection.isActive()) {
+        break;
+      }
       sendMove();
     }
   }
 
 };
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <bot_name>" << std::endl;
+int botMain(int argc, char *argv[]) {
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <bot_name> [view_radius]"
+              << std::endl;
     return 1;
   }
 #if SPDLOG_ACTIVE_LEVEL == SPDLOG_LEVEL_TRACE
   spdlog::set_level(spdlog::level::debug);
 #endif
   std::string botName = argv[1];
-  BotClient bot(botName);
+  int viewRadius = argc == 3 ? std::stoi(argv[2]) : 0;
+  BotClient bot(botName, viewRadius);
+  if (!bot.isConnected()) {
+    spdlog::critical("{}: Connection failed", botName);
+    return 1;
+  }
   bot.run();
   return 0;
 }
+
+CYCLES_BOT_MAIN(botMain)
@@ -0,0 +1,32 @@
+#include "api.h"
+#include <iostream>
+#include <spdlog/spdlog.h>
+#include <string>
+
+using namespace cycles;
+
+// Watches the game without playing, and logs the players still alive
+int main(int argc, char *argv[]) {
+  if (argc > 2) {
+    std::cerr << "Usage: " << argv[0] << " [frame_interval]" << std::endl;
+    return 1;
+  }
+#if SPDLOG_ACTIVE_LEVEL == SPDLOG_LEVEL_TRACE
+  spdlog::set_level(spdlog::level::debug);
+#endif
+  const int frameInterval = argc == 2 ? std::stoi(argv[1]) : 1;
+  Connection connection;
+  if (!connection.observe(frameInterval)) {
+    spdlog::critical("Connection failed");
+    return 1;
+  }
+  GameState state;
+  while (connection.isActive()) {
+    connection.receiveGameState(state);
+    if (connection.isActive()) {
+      spdlog::info("Frame {}: {} players alive", state.frameNumber,
+                   state.players.size());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include "anytime.h"
+#include "api.h"
+#include "utils.h"
+#include <algorithm>
+#include <iostream>
+#include <spdlog/spdlog.h>
+#include <string>
+
+using namespace cycles;
+
+// Moves towards the longest path of free cells it can find, searching deeper
+// and deeper until the time for the frame runs out
+class SurvivorBot {
+  Connection connection;
+  std::string name;
+  std::vector<Id> visited; // Same layout as GameState::grid
+
+  bool isFree(const GameState &state, sf::Vector2i position) {
+    if (!state.isInsideGrid(position) || !state.isInsideWindow(position)) {
+      return false;
+    }
+    return visited[(position.y - state.windowY) * state.windowWidth +
+                   (position.x - state.windowX)] == 0;
+  }
+
+  void setVisited(const GameState &state, sf::Vector2i position, Id value) {
+    visited[(position.y - state.windowY) * state.windowWidth +
+            (position.x - state.windowX)] = value;
+  }
+
+  int longestPath(SearchContext &context, sf::Vector2i position, int depth) {
+    if (depth == 0 || context.shouldStop()) {
+      return 0;
+    }
+    const auto &state = context.getState();
+    int best = 0;
+    for (int i = 0; i < 4 && best < depth; ++i) {
+      auto next = position + getDirectionVector(getDirectionFromValue(i));
+      if (!isFree(state, next)) {
+        continue;
+      }
+      setVisited(state, next, 1);
+      best = std::max(best, 1 + longestPath(context, next, depth - 1));
+      setVisited(state, next, 0);
+    }
+    return best;
+  }
+
+  void search(SearchContext &context) {
+    const auto &state = context.getState();
+    visited.assign(state.grid.begin(), state.grid.end());
+    for (int depth = 1; !context.shouldStop(); ++depth) {
+      int bestLength = -1;
+      Direction bestDirection = Direction::north;
+      for (int i = 0; i < 4; ++i) {
+        auto direction = getDirectionFromValue(i);
+        auto next = context.getPlayer().position + getDirectionVector(direction);
+        if (!isFree(state, next)) {
+          continue;
+        }
+        setVisited(state, next, 1);
+        int length = 1 + longestPath(context, next, depth - 1);
+        setVisited(state, next, 0);
+        if (length > bestLength) {
+          bestLength = length;
+          bestDirection = direction;
+        }
+      }
+      // An interrupted iteration is not better than the previous one
+      if (context.shouldStop() || bestLength < 0) {
+        break;
+      }
+      context.setBestMove(bestDirection);
+      spdlog::debug("{}: Depth {} completed in frame {}, {} left", name, depth,
+                    state.frameNumber,
+                    context.getRemainingTime().asMicroseconds());
+      // Searching deeper cannot find a longer path
+      if (bestLength < depth) {
+        break;
+      }
+    }
+  }
+
+public:
+  SurvivorBot(const std::string &botName) : name(botName) {
+    connection.connect(name);
+    if (!connection.isActive()) {
+      spdlog::critical("{}: Connection failed", name);
+      exit(1);
+    }
+  }
+
+  void run() {
+    AnytimeHarness harness(connection, name, [this](SearchContext &context) {
+      search(context);
+    });
+    harness.run();
+  }
+};
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <bot_name>" << std::endl;
+    return 1;
+  }
+#if SPDLOG_ACTIVE_LEVEL == SPDLOG_LEVEL_TRACE
+  spdlog::set_level(spdlog::level::debug);
+#endif
+  std::string botName = argv[1];
+  SurvivorBot bot(botName);
+  bot.run();
+  return 0;
+}
@@ -0,0 +1,558 @@
+#include "api.h"
+#include "transport.h"
+#include <SFML/Network.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <poll.h>
+#include <random>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace cycles;
+
+// Plays with thousands of lightweight bots from a single process, to load
+// the server with as many connections as it can take. The bots are spread
+// over a few threads, each one waiting on all of its sockets at once with
+// poll. They only read the header of the states and the cells around their
+// heads, without copying them into a GameState.
+//
+// Usage: loadgen [--option value]...
+//   --bots 255            Number of bots
+//   --threads 4           Threads that run them
+//   --think-ms 0          Mean time between receiving a state and moving
+//   --think fixed         Distribution of that time: fixed, uniform or
+//                         exponential
+//   --jitter-ms 0         Uniform noise added to the think time
+//   --slow-readers 0      Fraction of bots that only read every so often
+//   --slow-read-ms 500    How often they read, keeping only the last state
+//   --disconnect-rate 0   Probability of a bot leaving at every state
+//   --reconnect-ms 1000   Time until a bot that left joins again, -1 never
+//   --connect-rate 500    Bots connecting each second at the start
+//   --view-radius 0       Sent when joining, 0 for the whole grid
+//   --duration 0          Seconds to run, 0 to run until interrupted
+// The server is found through CYCLES_PORT and the room through CYCLES_ROOM.
+// The server removes the bots that do not answer a state within 50 ms, so
+// think times near it, and slow readers that read less often than that, lose
+// their bots like slow players would.
+namespace {
+
+struct Options {
+  int bots = 255;
+  int threads = 4;
+  double thinkMs = 0;
+  std::string think = "fixed";
+  double jitterMs = 0;
+  double slowReaders = 0;
+  double slowReadMs = 500;
+  double disconnectRate = 0;
+  double reconnectMs = 1000;
+  double connectRate = 500;
+  int viewRadius = 0;
+  double duration = 0;
+};
+
+// Shared by every thread, reported by the main one
+struct Statistics {
+  std::atomic<int> playing = 0;
+  std::atomic<std::uint64_t> states = 0;
+  std::atomic<std::uint64_t> moves = 0;
+  std::atomic<std::uint64_t> disconnects = 0;
+  std::atomic<std::uint64_t> failedConnections = 0;
+  std::atomic<std::int64_t> latencySum = 0; // us
+};
+
+// What a bot needs of a state, read in place from the message
+struct StateView {
+  sf::Vector2i position;
+  bool found = false;
+  sf::Int64 sendTime = 0;
+  int windowX = 0, windowY = 0, windowWidth = 0, windowHeight = 0;
+  int gridWidth = 0, gridHeight = 0;
+  const char *cells = nullptr;
+
+  bool isFree(sf::Vector2i cell) const {
+    if (cell.x < 0 || cell.x >= gridWidth || cell.y < 0 ||
+        cell.y >= gridHeight) {
+      return false;
+    }
+    const int x = cell.x - windowX;
+    const int y = cell.y - windowY;
+    // Outside the window nothing is known, it is as good as free
+    if (x < 0 || x >= windowWidth || y < 0 || y >= windowHeight) {
+      return true;
+    }
+    return cells[y * windowWidth + x] == 0;
+  }
+};
+
+// Reads the integers sf::Packet writes in network byte order
+class Reader {
+  std::span<const char> data;
+  std::size_t position = 0;
+
+public:
+  explicit Reader(std::span<const char> data) : data(data) {}
+
+  bool skip(std::size_t count) {
+    if (position + count > data.size()) {
+      return false;
+    }
+    position += count;
+    return true;
+  }
+
+  bool read(sf::Uint32 &value) {
+    if (position + 4 > data.size()) {
+      return false;
+    }
+    const auto *bytes =
+        reinterpret_cast<const unsigned char *>(data.data() + position);
+    value = (sf::Uint32(bytes[0]) << 24) | (sf::Uint32(bytes[1]) << 16) |
+            (sf::Uint32(bytes[2]) << 8) | sf::Uint32(bytes[3]);
+    position += 4;
+    return true;
+  }
+
+  bool read(int &value) {
+    sf::Uint32 bits;
+    if (!read(bits)) {
+      return false;
+    }
+    value = static_cast<sf::Int32>(bits);
+    return true;
+  }
+
+  bool read(sf::Int64 &value) {
+    sf::Uint32 high, low;
+    if (!read(high) || !read(low)) {
+      return false;
+    }
+    value = static_cast<sf::Int64>((sf::Uint64(high) << 32) | low);
+    return true;
+  }
+
+  const char *current() const { return data.data() + position; }
+};
+
+// See the state sent by the server in Room::sendGameState
+bool parseState(std::span<const char> message, const std::string &name,
+                StateView &view) {
+  Reader reader(message);
+  sf::Uint32 playerCount;
+  if (!reader.read(view.gridWidth) || !reader.read(view.gridHeight) ||
+      !reader.read(playerCount)) {
+    return false;
+  }
+  view.found = false;
+  for (sf::Uint32 i = 0; i < playerCount; ++i) {
+    sf::Vector2i position;
+    sf::Uint32 length;
+    if (!reader.read(position.x) || !reader.read(position.y) ||
+        !reader.skip(3) || !reader.read(length)) {
+      return false;
+    }
+    const char *playerName = reader.current();
+    if (!reader.skip(length) || !reader.skip(1 + 4)) {
+      return false;
+    }
+    if (length == name.size() &&
+        std::memcmp(playerName, name.data(), length) == 0) {
+      view.position = position;
+      view.found = true;
+    }
+  }
+  sf::Int64 moveDeadline;
+  if (!reader.read(view.sendTime) || !reader.read(moveDeadline) ||
+      !reader.read(view.windowX) || !reader.read(view.windowY) ||
+      !reader.read(view.windowWidth) || !reader.read(view.windowHeight)) {
+    return false;
+  }
+  view.cells = reader.current();
+  return reader.skip(std::size_t(std::max(view.windowWidth, 0)) *
+                     std::max(view.windowHeight, 0));
+}
+
+struct Bot {
+  enum class Phase { Disconnected, Connecting, Joining, Playing };
+
+  std::string name;
+  std::shared_ptr<TcpTransport> transport;
+  Phase phase = Phase::Disconnected;
+  bool slowReader = false;
+  sf::Int64 connectAt = 0;  // When disconnected, -1 for never
+  sf::Int64 connectDeadline = 0; // When connecting
+  sf::Int64 nextRead = 0;   // For slow readers
+  sf::Int64 moveAt = -1;    // A move is pending until then
+  bool sending = false;     // The move was not completely sent yet
+  Direction direction = Direction::north;
+  sf::Vector2i position;
+};
+
+class LoadThread {
+  const Options &options;
+  Statistics &statistics;
+  std::vector<Bot> bots;
+  std::mt19937 rng;
+  std::vector<pollfd> fds;
+  std::vector<Bot *> polled;
+
+public:
+  LoadThread(const Options &options, Statistics &statistics,
+             std::vector<Bot> bots, unsigned seed)
+      : options(options), statistics(statistics), bots(std::move(bots)),
+        rng(seed) {}
+
+  void run(const std::atomic<bool> &running) {
+    while (running) {
+      const auto now = getMonotonicTime();
+      sf::Int64 nextTimer = now + 10000;
+      fds.clear();
+      polled.clear();
+      for (auto &bot : bots) {
+        if (bot.phase == Bot::Phase::Disconnected) {
+          if (bot.connectAt >= 0 && bot.connectAt <= now) {
+            connect(bot, now);
+          } else if (bot.connectAt >= 0) {
+            nextTimer = std::min(nextTimer, bot.connectAt);
+          }
+          continue;
+        }
+        if (bot.phase == Bot::Phase::Connecting) {
+          if (bot.connectDeadline <= now) {
+            failConnection(bot, now);
+            continue;
+          }
+          nextTimer = std::min(nextTimer, bot.connectDeadline);
+          fds.push_back({bot.transport->getNativeHandle(), POLLOUT, 0});
+          polled.push_back(&bot);
+          continue;
+        }
+        if (bot.moveAt >= 0) {
+          if (bot.moveAt <= now) {
+            sendMove(bot);
+          } else {
+            nextTimer = std::min(nextTimer, bot.moveAt);
+          }
+        }
+        if (bot.sending) {
+          finishSending(bot);
+        }
+        if (bot.phase == Bot::Phase::Disconnected) {
+          continue;
+        }
+        if (bot.slowReader && bot.nextRead > now) {
+          nextTimer = std::min(nextTimer, bot.nextRead);
+          continue;
+        }
+        if (bot.slowReader) {
+          // Everything that piled up is read at once
+          bot.nextRead = now + options.slowReadMs * 1000;
+          receive(bot);
+          continue;
+        }
+        short events = POLLIN;
+        if (bot.sending) {
+          events |= POLLOUT;
+        }
+        fds.push_back({bot.transport->getNativeHandle(), events, 0});
+        polled.push_back(&bot);
+      }
+      const auto timeout = static_cast<int>(
+          std::max<sf::Int64>((nextTimer - getMonotonicTime()) / 1000, 0));
+      if (poll(fds.data(), fds.size(), timeout) <= 0) {
+        continue;
+      }
+      for (std::size_t i = 0; i < fds.size(); ++i) {
+        if (polled[i]->phase == Bot::Phase::Connecting) {
+          if (fds[i].revents != 0) {
+            finishConnecting(*polled[i], getMonotonicTime());
+          }
+          continue;
+        }
+        if (fds[i].revents & POLLOUT) {
+          finishSending(*polled[i]);
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+          receive(*polled[i]);
+        }
+      }
+    }
+    for (auto &bot : bots) {
+      if (bot.transport != nullptr) {
+        bot.transport->disconnect();
+      }
+    }
+  }
+
+private:
+  sf::Int64 sampleThinkTime() {
+    double ms = options.thinkMs;
+    if (options.think == "uniform") {
+      ms = std::uniform_real_distribution<double>(0, 2 * options.thinkMs)(rng);
+    } else if (options.think == "exponential" && options.thinkMs > 0) {
+      ms = std::exponential_distribution<double>(1 / options.thinkMs)(rng);
+    }
+    if (options.jitterMs > 0) {
+      ms += std::uniform_real_distribution<double>(-options.jitterMs,
+                                                   options.jitterMs)(rng);
+    }
+    return std::max(ms, 0.0) * 1000;
+  }
+
+  // Starts connecting without blocking, poll tells when the connection is
+  // done or failed
+  void connect(Bot &bot, sf::Int64 now) {
+    auto socket = std::make_shared<sf::TcpSocket>();
+    socket->setBlocking(false);
+    const char *port = std::getenv("CYCLES_PORT");
+    const auto status = socket->connect(SERVER_IP, std::stoi(port));
+    if (status != sf::Socket::Done && status != sf::Socket::NotReady) {
+      ++statistics.failedConnections;
+      bot.connectAt = now + 1000000;
+      return;
+    }
+    bot.transport = std::make_shared<TcpTransport>(socket);
+    bot.phase = Bot::Phase::Connecting;
+    bot.connectDeadline = now + 1000000;
+    if (status == sf::Socket::Done) {
+      finishConnecting(bot, now);
+    }
+  }
+
+  void failConnection(Bot &bot, sf::Int64 now) {
+    ++statistics.failedConnections;
+    bot.transport->disconnect();
+    bot.transport = nullptr;
+    bot.phase = Bot::Phase::Disconnected;
+    bot.connectAt = now + 1000000;
+  }
+
+  // Sends the name once the socket is connected
+  void finishConnecting(Bot &bot, sf::Int64 now) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(bot.transport->getNativeHandle(), SOL_SOCKET, SO_ERROR,
+                   &error, &length) != 0 ||
+        error != 0) {
+      failConnection(bot, now);
+      return;
+    }
+    sf::Packet namePacket;
+    namePacket << bot.name << static_cast<sf::Int32>(options.viewRadius)
+               << detail::getRequestedRoom();
+    if (detail::sendPacket(*bot.transport, namePacket) != sf::Socket::Done) {
+      leave(bot, now);
+      return;
+    }
+    bot.phase = Bot::Phase::Joining;
+    bot.moveAt = -1;
+    bot.sending = false;
+  }
+
+  void leave(Bot &bot, sf::Int64 now) {
+    if (bot.phase == Bot::Phase::Playing) {
+      --statistics.playing;
+    }
+    ++statistics.disconnects;
+    bot.transport->disconnect();
+    bot.transport = nullptr;
+    bot.phase = Bot::Phase::Disconnected;
+    bot.connectAt =
+        options.reconnectMs < 0 ? -1 : now + options.reconnectMs * 1000;
+  }
+
+  void receive(Bot &bot) {
+    std::span<const char> message;
+    bool gotState = false;
+    StateView view;
+    while (bot.transport != nullptr) {
+      const auto status = bot.transport->receive(message);
+      if (status == sf::Socket::NotReady) {
+        break;
+      }
+      const auto now = getMonotonicTime();
+      if (status != sf::Socket::Done) {
+        leave(bot, now);
+        return;
+      }
+      if (bot.phase == Bot::Phase::Joining) {
+        // The reply with the colour
+        bot.phase = Bot::Phase::Playing;
+        ++statistics.playing;
+        continue;
+      }
+      if (!parseState(message, bot.name, view)) {
+        spdlog::warn("{}: Received a malformed state", bot.name);
+        leave(bot, now);
+        return;
+      }
+      ++statistics.states;
+      statistics.latencySum += now - view.sendTime;
+      // Only the newest state is answered, the message is only valid until
+      // the next receive
+      gotState = view.found;
+      if (gotState) {
+        bot.position = view.position;
+        chooseDirection(bot, view);
+      }
+    }
+    if (!gotState) {
+      return;
+    }
+    const auto now = getMonotonicTime();
+    if (options.disconnectRate > 0 &&
+        std::bernoulli_distribution(options.disconnectRate)(rng)) {
+      leave(bot, now);
+      return;
+    }
+    bot.moveAt = now + sampleThinkTime();
+  }
+
+  // Keeps going straight unless it is blocked, sometimes turning
+  void chooseDirection(Bot &bot, const StateView &view) {
+    auto isFree = [&](Direction direction) {
+      return view.isFree(bot.position + getDirectionVector(direction));
+    };
+    if (isFree(bot.direction) &&
+        !std::bernoulli_distribution(0.05)(rng)) {
+      return;
+    }
+    const int first = std::uniform_int_distribution<int>(0, 3)(rng);
+    for (int i = 0; i < 4; ++i) {
+      const auto direction = getDirectionFromValue((first + i) % 4);
+      if (isFree(direction)) {
+        bot.direction = direction;
+        return;
+      }
+    }
+  }
+
+  void sendMove(Bot &bot) {
+    bot.moveAt = -1;
+    sf::Packet move;
+    move << getDirectionValue(bot.direction);
+    const auto status = bot.transport->send(move);
+    if (status != sf::Socket::Done && status != sf::Socket::NotReady) {
+      leave(bot, getMonotonicTime());
+      return;
+    }
+    ++statistics.moves;
+    // Sent in the next iterations if the socket is full
+    bot.sending = true;
+    finishSending(bot);
+  }
+
+  void finishSending(Bot &bot) {
+    const auto status = bot.transport->flush();
+    if (status == sf::Socket::Done) {
+      bot.sending = false;
+    } else if (status != sf::Socket::NotReady) {
+      leave(bot, getMonotonicTime());
+    }
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (std::getenv("CYCLES_PORT") == nullptr) {
+    spdlog::critical("Please set the CYCLES_PORT environment variable");
+    return 1;
+  }
+  Options options;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string option = argv[i];
+    const std::string value = argv[i + 1];
+    if (option == "--bots") {
+      options.bots = std::stoi(value);
+    } else if (option == "--threads") {
+      options.threads = std::max(std::stoi(value), 1);
+    } else if (option == "--think-ms") {
+      options.thinkMs = std::stod(value);
+    } else if (option == "--think") {
+      options.think = value;
+    } else if (option == "--jitter-ms") {
+      options.jitterMs = std::stod(value);
+    } else if (option == "--slow-readers") {
+      options.slowReaders = std::stod(value);
+    } else if (option == "--slow-read-ms") {
+      options.slowReadMs = std::stod(value);
+    } else if (option == "--disconnect-rate") {
+      options.disconnectRate = std::stod(value);
+    } else if (option == "--reconnect-ms") {
+      options.reconnectMs = std::stod(value);
+    } else if (option == "--connect-rate") {
+      options.connectRate = std::max(std::stod(value), 1.0);
+    } else if (option == "--view-radius") {
+      options.viewRadius = std::stoi(value);
+    } else if (option == "--duration") {
+      options.duration = std::stod(value);
+    } else {
+      spdlog::critical("Unknown option {}", option);
+      return 1;
+    }
+  }
+  if (options.think != "fixed" && options.think != "uniform" &&
+      options.think != "exponential") {
+    spdlog::critical("Unknown think time distribution {}", options.think);
+    return 1;
+  }
+  Statistics statistics;
+  std::vector<std::vector<Bot>> assigned(options.threads);
+  std::mt19937 rng(std::random_device{}());
+  std::bernoulli_distribution slow(options.slowReaders);
+  const auto start = getMonotonicTime();
+  for (int i = 0; i < options.bots; ++i) {
+    Bot bot;
+    bot.name = "load" + std::to_string(i);
+    bot.slowReader = slow(rng);
+    // Joining all at once would fill the backlog of the listener
+    bot.connectAt = start + i * 1e6 / options.connectRate;
+    assigned[i % options.threads].push_back(std::move(bot));
+  }
+  std::atomic<bool> running = true;
+  std::vector<std::unique_ptr<LoadThread>> loads;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.threads; ++i) {
+    loads.push_back(std::make_unique<LoadThread>(
+        options, statistics, std::move(assigned[i]), rng()));
+    threads.emplace_back(&LoadThread::run, loads.back().get(),
+                         std::cref(running));
+  }
+  spdlog::info("Running {} bots in {} threads", options.bots,
+               options.threads);
+  std::uint64_t lastStates = 0, lastMoves = 0;
+  std::int64_t lastLatency = 0;
+  sf::Clock clock;
+  while (options.duration <= 0 ||
+         clock.getElapsedTime().asSeconds() < options.duration) {
+    sf::sleep(sf::seconds(5));
+    const std::uint64_t states = statistics.states;
+    const std::uint64_t moves = statistics.moves;
+    const std::int64_t latency = statistics.latencySum;
+    spdlog::info("{} playing, {:.0f} states/s, {:.0f} moves/s, {:.0f} us "
+                 "state latency, {} disconnects, {} failed connections",
+                 statistics.playing.load(), (states - lastStates) / 5.0,
+                 (moves - lastMoves) / 5.0,
+                 states > lastStates
+                     ? double(latency - lastLatency) / (states - lastStates)
+                     : 0.0,
+                 statistics.disconnects.load(),
+                 statistics.failedConnections.load());
+    lastStates = states;
+    lastMoves = moves;
+    lastLatency = latency;
+  }
+  running = false;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return 0;
+}
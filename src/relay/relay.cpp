@@ -0,0 +1,174 @@
+#include "api.h"
+#include "transport.h"
+#include <SFML/Network.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+
+using namespace cycles;
+
+// Connects to the server as a single spectator and sends the states it
+// receives to any number of spectators connected to it. However many they
+// are, the server only sends each state once
+class Relay {
+  struct Viewer {
+    std::shared_ptr<TcpTransport> transport;
+    sf::Uint32 frameInterval;
+  };
+
+  struct PendingViewer {
+    std::shared_ptr<TcpTransport> transport;
+    sf::Clock clock;
+  };
+
+  std::shared_ptr<Transport> upstream;
+  sf::TcpListener listener;
+  std::vector<PendingViewer> pendingViewers;
+  std::vector<Viewer> viewers;
+  std::uint64_t statesRelayed = 0;
+
+public:
+  Relay() {
+    const char *portenv = std::getenv("CYCLES_RELAY_PORT");
+    if (portenv == nullptr) {
+      spdlog::critical("Please set the CYCLES_RELAY_PORT environment variable");
+      exit(1);
+    }
+    const unsigned short PORT = std::stoi(portenv);
+    listener.listen(PORT);
+    listener.setBlocking(false);
+    if (listener.getLocalPort() == 0) {
+      spdlog::critical("Failed to bind to port {}", PORT);
+      exit(1);
+    }
+    spdlog::info("Relaying to spectators on port {}", PORT);
+  }
+
+  bool connect() {
+    upstream = detail::establishLink();
+    if (upstream == nullptr) {
+      return false;
+    }
+    // Relays the room selected by CYCLES_ROOM
+    const auto request =
+        detail::makeObserverRequest(1, detail::getRequestedRoom());
+    if (detail::sendPacket(*upstream, request) != sf::Socket::Done) {
+      spdlog::critical("Failed to send the spectator request");
+      return false;
+    }
+    std::span<const char> reply;
+    if (upstream->receive(reply, sf::seconds(10)) != sf::Socket::Done) {
+      spdlog::critical("The server did not accept the relay");
+      return false;
+    }
+    return true;
+  }
+
+  void run() {
+    while (upstream->isConnected()) {
+      acceptViewers();
+      // Short enough to accept new spectators promptly
+      upstream->wait(sf::milliseconds(5));
+      std::span<const char> message;
+      auto status = upstream->receive(message);
+      while (status == sf::Socket::Done) {
+        relay(message);
+        status = upstream->receive(message);
+      }
+      if (status != sf::Socket::NotReady) {
+        spdlog::info("Disconnected from the server: {}",
+                     socketErrorToString(status));
+        break;
+      }
+      for (auto &viewer : viewers) {
+        viewer.transport->flush();
+      }
+      const auto disconnected =
+          std::erase_if(viewers, [](const Viewer &viewer) {
+            return !viewer.transport->isConnected();
+          });
+      if (disconnected > 0) {
+        spdlog::info("{} spectators have disconnected, {} left", disconnected,
+                     viewers.size());
+      }
+    }
+    for (auto &viewer : viewers) {
+      viewer.transport->disconnect();
+    }
+  }
+
+private:
+  void acceptViewers() {
+    auto socket = std::make_shared<sf::TcpSocket>();
+    while (listener.accept(*socket) == sf::Socket::Done) {
+      pendingViewers.push_back({std::make_shared<TcpTransport>(socket), {}});
+      socket = std::make_shared<sf::TcpSocket>();
+    }
+    // The request of a spectator may take a while to arrive, the others are
+    // not kept waiting meanwhile
+    std::erase_if(pendingViewers, [this](PendingViewer &pending) {
+      std::span<const char> message;
+      const auto status = pending.transport->receive(message);
+      if (status == sf::Socket::NotReady) {
+        if (pending.clock.getElapsedTime() < sf::seconds(1)) {
+          return false;
+        }
+        spdlog::warn("A spectator did not send its request");
+      } else if (status == sf::Socket::Done) {
+        handshake(pending.transport, message);
+      }
+      return true;
+    });
+  }
+
+  void handshake(std::shared_ptr<TcpTransport> transport,
+                 std::span<const char> message) {
+    sf::Uint32 frameInterval = 1;
+    // The relay only receives the room it was started for
+    sf::Int32 room = -1;
+    if (!detail::isObserverRequest(message, frameInterval, room)) {
+      spdlog::warn("Only spectators can connect to the relay");
+      transport->disconnect();
+      return;
+    }
+    sf::Packet reply;
+    reply << getMonotonicTime();
+    if (transport->send(reply) != sf::Socket::Done) {
+      transport->disconnect();
+      return;
+    }
+    viewers.push_back({transport, frameInterval});
+    spdlog::info("New spectator connected, one of every {} frames, {} in "
+                 "total",
+                 frameInterval, viewers.size());
+  }
+
+  void relay(std::span<const char> message) {
+    // A single copy shared by all the spectators, those that do not keep up
+    // only get the newest one
+    auto packet = std::make_shared<sf::Packet>();
+    packet->append(message.data(), message.size());
+    for (auto &viewer : viewers) {
+      if (statesRelayed % viewer.frameInterval == 0) {
+        viewer.transport->sendLatest(packet);
+      }
+    }
+    ++statesRelayed;
+  }
+};
+
+int main() {
+#if SPDLOG_ACTIVE_LEVEL == SPDLOG_LEVEL_TRACE
+  spdlog::set_level(spdlog::level::debug);
+#endif
+  Relay relay;
+  if (!relay.connect()) {
+    return 1;
+  }
+  relay.run();
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "bot_host.h"
+#include <spdlog/spdlog.h>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace cycles_server {
+
+namespace {
+using BotMain = int (*)(std::shared_ptr<cycles::Transport> *, int, char **);
+
+void *openLibrary(const std::string &path) {
+#ifdef _WIN32
+  return LoadLibraryA(path.c_str());
+#else
+  return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+BotMain findBotMain(void *library) {
+#ifdef _WIN32
+  return reinterpret_cast<BotMain>(
+      GetProcAddress(static_cast<HMODULE>(library), "cycles_bot_main"));
+#else
+  return reinterpret_cast<BotMain>(dlsym(library, "cycles_bot_main"));
+#endif
+}
+
+void closeLibrary(void *library) {
+#ifdef _WIN32
+  FreeLibrary(static_cast<HMODULE>(library));
+#else
+  dlclose(library);
+#endif
+}
+} // namespace
+
+BotHost::BotHost(const std::vector<BotConfiguration> &bots,
+                 AddClient addClient) {
+  for (const auto &bot : bots) {
+    void *library = openLibrary(bot.library);
+    if (library == nullptr) {
+      spdlog::critical("Failed to load bot library {}", bot.library);
+      exit(1);
+    }
+    libraries.push_back(library);
+    auto botMain = findBotMain(library);
+    if (botMain == nullptr) {
+      spdlog::critical("Bot library {} does not define cycles_bot_main, use "
+                       "CYCLES_BOT_MAIN",
+                       bot.library);
+      exit(1);
+    }
+    for (int i = 0; i < bot.count; ++i) {
+      std::vector<std::string> arguments = {bot.library, bot.name};
+      if (bot.count > 1) {
+        arguments[1] += std::to_string(i + 1);
+      }
+      arguments.insert(arguments.end(), bot.arguments.begin(),
+                       bot.arguments.end());
+      auto [serverEnd, botEnd] = cycles::makeInProcessTransportPair();
+      addClient(serverEnd);
+      botTransports.push_back(botEnd);
+      threads.emplace_back([botMain, botEnd, arguments]() mutable {
+        std::vector<char *> argv;
+        for (auto &argument : arguments) {
+          argv.push_back(argument.data());
+        }
+        argv.push_back(nullptr);
+        const int status =
+            botMain(&botEnd, static_cast<int>(arguments.size()), argv.data());
+        if (status != 0) {
+          spdlog::warn("Bot {} returned {}", arguments[1], status);
+        }
+      });
+      spdlog::info("Started bot {} from {}", arguments[1], bot.library);
+    }
+  }
+}
+
+BotHost::~BotHost() {
+  for (auto &transport : botTransports) {
+    transport->disconnect();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto library : libraries) {
+    closeLibrary(library);
+  }
+}
+
+} // namespace cycles_server
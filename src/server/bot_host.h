@@ -0,0 +1,29 @@
+#pragma once
+#include "server.h"
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace cycles_server {
+
+// Runs the bots compiled as shared libraries (see CYCLES_BOT_MAIN) in threads
+// of the server. They reach the server through in-process transports instead
+// of TCP.
+class BotHost {
+public:
+  using AddClient = std::function<void(std::shared_ptr<cycles::Transport>)>;
+
+  // addClient receives the server end of the transport of every bot
+  BotHost(const std::vector<BotConfiguration> &bots, AddClient addClient);
+
+  // Disconnects the bots and waits for them to return
+  ~BotHost();
+
+private:
+  std::vector<void *> libraries;
+  std::vector<std::shared_ptr<cycles::Transport>> botTransports;
+  std::vector<std::thread> threads;
+};
+
+} // namespace cycles_server
@@ -34,11 +34,72 @@ namespace cycles_server{
     if (config["enablePostProcessing"]) {
       enablePostProcessing = config["enablePostProcessing"].as<bool>();
     }
+    if (config["headless"]) {
+      headless = config["headless"].as<bool>();
+    }
+    if (config["startPlayers"]) {
+      startPlayers = config["startPlayers"].as<int>();
+    }
+    if (config["joinTimeout"]) {
+      joinTimeout = config["joinTimeout"].as<float>();
+    }
+    if (config["matches"]) {
+      matches = config["matches"].as<int>();
+    }
+    if (config["resultsFile"]) {
+      resultsFile = config["resultsFile"].as<std::string>();
+    }
+    if (config["frameTime"]) {
+      frameTime = config["frameTime"].as<int>();
+    }
+    if (config["frameStatsFile"]) {
+      frameStatsFile = config["frameStatsFile"].as<std::string>();
+    }
+    if (config["rooms"]) {
+      rooms = config["rooms"].as<int>();
+    }
+    if (config["workers"]) {
+      workers = config["workers"].as<int>();
+    }
+    if (config["recordDirectory"]) {
+      recordDirectory = config["recordDirectory"].as<std::string>();
+    }
+    if (config["recordFormat"]) {
+      recordFormat = config["recordFormat"].as<std::string>();
+    }
+    if (config["recordWorkers"]) {
+      recordWorkers = config["recordWorkers"].as<int>();
+    }
+    if (config["recordQueue"]) {
+      recordQueue = config["recordQueue"].as<int>();
+    }
+    if (config["bots"]) {
+      for (const auto &node : config["bots"]) {
+        BotConfiguration bot;
+        bot.library = node["library"].as<std::string>();
+        bot.name = node["name"]
+                       ? node["name"].as<std::string>()
+                       : std::filesystem::path(bot.library).stem().string();
+        if (node["count"]) {
+          bot.count = node["count"].as<int>();
+        }
+        if (node["arguments"]) {
+          bot.arguments = node["arguments"].as<std::vector<std::string>>();
+        }
+        bots.push_back(bot);
+      }
+    }
 
     std::set<std::string> knownParameters = {"maxClients", "gridWidth",
                                              "gridHeight", "gameWidth",
                                              "gameHeight", "gameBannerHeight",
-					     "enablePostProcessing"};
+					     "enablePostProcessing", "headless",
+					     "startPlayers", "joinTimeout", "matches",
+					     "resultsFile", "frameTime",
+					     "frameStatsFile", "rooms", "workers",
+					     "recordDirectory", "recordFormat",
+					     "recordWorkers", "recordQueue",
+					     "bots"};
     // Warn if there are unknown parameters
     for (const auto &it : config) {
       if (knownParameters.find(it.first.as<std::string>()) ==
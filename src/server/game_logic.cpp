@@ -1,4 +1,5 @@
 #include "game_logic.h"
+#include <algorithm>
 #include <map>
 #include <random>
 #include <set>
@@ -73,6 +74,7 @@ sf::Color getRandomColor(auto rng) {
 
 Id Game::addPlayer(const std::string &name) {
   static std::vector<uint32_t> palette = detail::generateColorPalette(300);
+  std::scoped_lock lock(gameMutex);
   gameStarted = true;
   Player newPlayer;
   newPlayer.name = name;
@@ -90,6 +92,11 @@ Id Game::addPlayer(const std::string &name) {
 }
 
 void Game::removePlayer(Id id) {
+  std::scoped_lock lock(gameMutex);
+  erasePlayer(id);
+}
+
+void Game::erasePlayer(Id id) {
   auto player_it = players.find(id);
   if (player_it == players.end()) {
     return;
@@ -106,6 +113,7 @@ void Game::movePlayers(std::map<Id, Direction> directions) {
   if (directions.size() == 0) {
     return;
   }
+  std::scoped_lock lock(gameMutex);
   max_tail_length = 55 + frame / 100;
   // Sanitize directions
   directions = detail::removeNonExistentPlayers(directions, players);
@@ -127,7 +135,7 @@ void Game::movePlayers(std::map<Id, Direction> directions) {
   // Check for collisions
   auto colliding = checkCollisions(newPositions);
   for (auto id : colliding) {
-    removePlayer(id);
+    erasePlayer(id);
     newPositions.erase(id);
   }
   // Move remaining players
@@ -147,6 +155,43 @@ void Game::movePlayers(std::map<Id, Direction> directions) {
   }
 }
 
+void Game::reset() {
+  std::scoped_lock lock(gameMutex);
+  players.clear();
+  std::fill(grid.begin(), grid.end(), 0);
+  idCounter = 1;
+  frame = 0;
+  gameStarted = false;
+  max_tail_length = 55;
+}
+
+void Game::getSnapshot(Snapshot &snapshot) {
+  std::scoped_lock lock(gameMutex);
+  snapshot.frame = frame;
+  snapshot.gridWidth = conf.gridWidth;
+  snapshot.gridHeight = conf.gridHeight;
+  snapshot.gameOver = gameStarted && players.size() <= 1;
+  snapshot.players.resize(players.size());
+  auto target = snapshot.players.begin();
+  for (const auto &[id, player] : players) {
+    target->id = id;
+    target->name = player.name;
+    target->color = player.color;
+    target->position = player.position;
+    ++target;
+  }
+  snapshot.grid.assign(grid.begin(), grid.end());
+}
+
+sf::IntRect Game::getViewWindow(sf::Vector2i center, int radius) const {
+  const int left = std::max(center.x - radius, 0);
+  const int top = std::max(center.y - radius, 0);
+  const int right = std::min(center.x + radius + 1, conf.gridWidth);
+  const int bottom = std::min(center.y + radius + 1, conf.gridHeight);
+  return sf::IntRect(left, top, std::max(right - left, 0),
+                     std::max(bottom - top, 0));
+}
+
 bool Game::legalMove(sf::Vector2i newPos) {
   if (newPos.x < 0 || newPos.x >= conf.gridWidth || newPos.y < 0 ||
       newPos.y >= conf.gridHeight) {
@@ -31,14 +31,41 @@ public:
 
   void movePlayers(std::map<Id, Direction> directions);
 
+  /**
+   * @brief Remove every player and empty the grid for a new match
+   *
+   * The grid keeps its memory, and ids are given again from 1.
+   */
+  void reset();
+
   const auto &getGrid() { return grid; }
 
+  /**
+   * @brief Get the part of the grid seen by an observer at a given position
+   *
+   * The window is the square of side 2*radius+1 centered at center, clipped
+   * to the grid bounds.
+   */
+  sf::IntRect getViewWindow(sf::Vector2i center, int radius) const;
+
   auto getPlayers() {
     std::scoped_lock lock(gameMutex);
     return players;
   }
 
-  void setFrame(int frame) { this->frame = frame; }
+  /**
+   * @brief Copy what is drawn of the game
+   *
+   * Can be called from another thread while the game goes on. The capacity
+   * of the snapshot is reused.
+   */
+  void getSnapshot(Snapshot &snapshot);
+
+  // Under the lock like the other changes, getSnapshot reads the frame
+  void setFrame(int frame) {
+    std::scoped_lock lock(gameMutex);
+    this->frame = frame;
+  }
 
   int getFrame() { return frame; }
 
@@ -46,6 +73,8 @@ public:
 
 private:
 
+  void erasePlayer(Id id);
+
   Id &getCell(int x, int y) { return grid[y * conf.gridWidth + x]; }
 
   bool legalMove(sf::Vector2i newPos);
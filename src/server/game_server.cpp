@@ -0,0 +1,266 @@
+#include "game_server.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cstdlib>
+#include <spdlog/spdlog.h>
+#include <utility>
+
+namespace cycles_server {
+
+GameServer::GameServer(Configuration conf, sf::Time resultTime)
+    : conf(conf), running(false) {
+  const char *portenv = std::getenv("CYCLES_PORT");
+  if (portenv == nullptr) {
+    spdlog::critical("Please set the CYCLES_PORT environment variable");
+    exit(1);
+  }
+  spdlog::info("Listening on port {}", portenv);
+  const unsigned short PORT = std::stoi(portenv);
+  listener.listen(PORT);
+  listener.setBlocking(false);
+  if (listener.getLocalPort() == 0) {
+    spdlog::critical("Failed to bind to port {}", PORT);
+    exit(1);
+  }
+  for (int i = 0; i < conf.rooms; ++i) {
+    rooms.push_back(std::make_unique<Room>(
+        i, conf, getSnapshotSegmentName(listener.getLocalPort(), i),
+        resultTime));
+  }
+}
+
+void GameServer::start() {
+  running = true;
+  acceptThread = std::thread(&GameServer::acceptClients, this);
+  int workerCount = conf.workers;
+  if (workerCount <= 0) {
+    workerCount = std::max<int>(std::thread::hardware_concurrency(), 1);
+  }
+  workerCount = std::min(workerCount, conf.rooms);
+  // Each room is always played by the same thread
+  for (int worker = 0; worker < workerCount; ++worker) {
+    std::vector<Room *> assigned;
+    for (int i = worker; i < conf.rooms; i += workerCount) {
+      assigned.push_back(rooms[i].get());
+    }
+    workers.emplace_back(&GameServer::playRooms, this, assigned);
+  }
+  spdlog::info("Playing {} rooms with {} threads", conf.rooms, workerCount);
+}
+
+void GameServer::stop() {
+  running = false;
+  if (acceptThread.joinable()) {
+    acceptThread.join();
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+bool GameServer::isFinished() const {
+  return std::all_of(rooms.begin(), rooms.end(), [](const auto &room) {
+    return room->getPhase() == Room::Phase::Finished;
+  });
+}
+
+void GameServer::requestStart() {
+  for (auto &room : rooms) {
+    room->requestStart();
+  }
+}
+
+void GameServer::addClient(std::shared_ptr<cycles::Transport> client) {
+  std::scoped_lock lock(pendingMutex);
+  pendingClients.push_back(client);
+}
+
+// New connections and the names of the clients are read without blocking, so
+// a client that is slow to send its name does not hold back the others
+void GameServer::acceptClients() {
+  sf::SocketSelector selector;
+  while (running) {
+    selector.clear();
+    selector.add(listener);
+    for (const auto &handshake : handshakes) {
+      if (auto *socket = handshake.transport->getWaitableSocket()) {
+        selector.add(*socket);
+      }
+    }
+    // Short enough to pick the in-process clients up quickly
+    if (selector.wait(sf::milliseconds(10)) && selector.isReady(listener)) {
+      while (true) {
+        auto clientSocket = std::make_shared<sf::TcpSocket>();
+        if (listener.accept(*clientSocket) != sf::Socket::Done) {
+          break;
+        }
+        handshakes.push_back(
+            {std::make_shared<cycles::TcpTransport>(
+                 clientSocket, cycles::detail::defaultMaxQueuedBytes,
+                 cycles::detail::maxClientMessageSize),
+             clientSocket, sf::Clock()});
+      }
+    }
+    {
+      std::scoped_lock lock(pendingMutex);
+      for (auto &client : pendingClients) {
+        handshakes.push_back({client, nullptr, sf::Clock()});
+      }
+      pendingClients.clear();
+    }
+    std::erase_if(handshakes, [this](Handshake &handshake) {
+      return advanceHandshake(handshake);
+    });
+  }
+  for (const auto &handshake : handshakes) {
+    handshake.transport->disconnect();
+  }
+  handshakes.clear();
+}
+
+void GameServer::playRooms(std::vector<Room *> assigned) {
+  sf::SocketSelector selector;
+  while (running) {
+    bool collecting = false;
+    bool waitable = true;
+    selector.clear();
+    for (auto *room : assigned) {
+      room->step();
+      if (room->isCollectingMoves()) {
+        collecting = true;
+        waitable = room->addWaitableSockets(selector) && waitable;
+      }
+    }
+    // Waits until some of the clients have data, so that they are not
+    // polled one by one in a loop. Transports that cannot be waited on this
+    // way are polled
+    if (!collecting) {
+      sf::sleep(sf::milliseconds(1));
+    } else if (!waitable) {
+      std::this_thread::yield();
+    } else {
+      // Short enough to keep repeating lost UDP states and checking
+      // timeouts
+      selector.wait(sf::milliseconds(1));
+    }
+  }
+}
+
+// Rooms about to start are filled first, then clients wait in the others
+// for their next match
+Room *GameServer::findRoom(sf::Int32 requested) {
+  if (requested >= static_cast<int>(rooms.size())) {
+    spdlog::warn("There is no room {}, choosing another one", requested);
+  } else if (requested >= 0) {
+    auto &room = *rooms[requested];
+    if (room.willPlayAgain() && room.getReservedPlayers() < conf.maxClients) {
+      return &room;
+    }
+    return nullptr;
+  }
+  const int startPlayers = conf.startPlayers > 0
+                               ? std::min(conf.startPlayers, conf.maxClients)
+                               : conf.maxClients;
+  for (auto &room : rooms) {
+    if (room->getPhase() == Room::Phase::Lobby &&
+        room->getReservedPlayers() < startPlayers) {
+      return room.get();
+    }
+  }
+  for (auto &room : rooms) {
+    if (room->willPlayAgain() &&
+        room->getReservedPlayers() < conf.maxClients) {
+      return room.get();
+    }
+  }
+  return nullptr;
+}
+
+// Reads the next message of the client if it arrived. Returns true once the
+// client was handed to a room or dropped
+bool GameServer::advanceHandshake(Handshake &handshake) {
+  std::span<const char> message;
+  const auto status = handshake.transport->receive(message);
+  if (status == sf::Socket::NotReady) {
+    if (handshake.clock.getElapsedTime() < handshakeTimeout) {
+      return false;
+    }
+    spdlog::warn("A client did not send its name, closing the connection");
+    handshake.transport->disconnect();
+    return true;
+  }
+  if (status != sf::Socket::Done) {
+    spdlog::warn("A client disconnected before sending its name");
+    handshake.transport->disconnect();
+    return true;
+  }
+  auto socket = std::exchange(handshake.socket, nullptr);
+  handshake.clock.restart();
+  // Clients can ask to receive the states through UDP, the name comes next
+  if (socket != nullptr && cycles::UdpTransport::isAttachRequest(message)) {
+    auto client = cycles::UdpTransport::accept(socket, message);
+    if (client == nullptr) {
+      spdlog::warn("A client failed to set up UDP, closing the connection");
+      socket->disconnect();
+      return true;
+    }
+    handshake.transport = client;
+    return false;
+  }
+#ifndef _WIN32
+  // Clients in the same host can ask to use shared memory instead
+  if (socket != nullptr && cycles::ShmTransport::isAttachRequest(message)) {
+    auto client = cycles::ShmTransport::accept(socket, message);
+    if (client == nullptr) {
+      spdlog::warn("A client failed to set up shared memory, closing the "
+                   "connection");
+      socket->disconnect();
+      return true;
+    }
+    handshake.transport = client;
+    return false;
+  }
+#endif
+  finishHandshake(handshake.transport, message);
+  return true;
+}
+
+void GameServer::finishHandshake(std::shared_ptr<cycles::Transport> client,
+                                 std::span<const char> message) {
+  sf::Uint32 frameInterval = 1;
+  sf::Int32 requestedRoom = -1;
+  if (cycles::detail::isObserverRequest(message, frameInterval,
+                                        requestedRoom)) {
+    sf::Packet reply;
+    reply << cycles::getMonotonicTime();
+    if (client->send(reply) != sf::Socket::Done) {
+      spdlog::warn("Failed to reply to a spectator");
+      client->disconnect();
+      return;
+    }
+    const bool valid =
+        requestedRoom >= 0 && requestedRoom < static_cast<int>(rooms.size());
+    rooms[valid ? requestedRoom : 0]->addObserver(client, frameInterval);
+    return;
+  }
+  sf::Packet namePacket;
+  namePacket.append(message.data(), message.size());
+  std::string playerName;
+  namePacket >> playerName;
+  // Optional, clients that do not send it observe the whole grid
+  sf::Int32 viewRadius = 0;
+  namePacket >> viewRadius;
+  // Optional too, the server chooses the room if it is not sent
+  namePacket >> requestedRoom;
+  auto *room = findRoom(requestedRoom);
+  if (room == nullptr) {
+    spdlog::warn("No room can take {}, closing the connection", playerName);
+    client->disconnect();
+    return;
+  }
+  // The room replies with the color once it adds the player
+  room->addClient({client, playerName, viewRadius});
+}
+
+} // namespace cycles_server
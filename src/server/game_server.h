@@ -0,0 +1,76 @@
+#pragma once
+#include "room.h"
+#include "server.h"
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace cycles_server {
+
+// Accepts the clients and routes them to the rooms, which are played by a
+// pool of worker threads. It listens on the port in CYCLES_PORT, 0 picks any
+// free one
+class GameServer {
+public:
+  GameServer(Configuration conf, sf::Time resultTime);
+
+  ~GameServer() { stop(); }
+
+  // Starts accepting clients and playing the rooms
+  void start();
+
+  void stop();
+
+  unsigned short getPort() const { return listener.getLocalPort(); }
+
+  Room &getRoom(int index) { return *rooms.at(index); }
+
+  // Every room played its last match
+  bool isFinished() const;
+
+  // Starts the matches of the rooms waiting for players
+  void requestStart();
+
+  /**
+   * @brief Queue a client that is already linked to the server, such as an
+   * in-process bot, to be accepted with the ones connecting through TCP
+   */
+  void addClient(std::shared_ptr<cycles::Transport> client);
+
+private:
+  // A client that did not send its name yet
+  struct Handshake {
+    std::shared_ptr<cycles::Transport> transport;
+    // Only for clients that connected through TCP and did not attach another
+    // transport yet
+    std::shared_ptr<sf::TcpSocket> socket;
+    sf::Clock clock; // Since its last message
+  };
+
+  sf::TcpListener listener;
+  std::vector<std::unique_ptr<Room>> rooms;
+  // Clients added from other threads, handshaken by acceptClients
+  std::vector<std::shared_ptr<cycles::Transport>> pendingClients;
+  std::mutex pendingMutex;
+  // Only used by the accept thread, which never waits for a single client
+  std::vector<Handshake> handshakes;
+  const Configuration conf;
+  std::atomic<bool> running;
+  std::thread acceptThread;
+  std::vector<std::thread> workers;
+
+  const sf::Time handshakeTimeout = sf::seconds(1);
+
+  void acceptClients();
+  void playRooms(std::vector<Room *> assigned);
+  Room *findRoom(sf::Int32 requested);
+  bool advanceHandshake(Handshake &handshake);
+  void finishHandshake(std::shared_ptr<cycles::Transport> client,
+                       std::span<const char> message);
+};
+
+} // namespace cycles_server
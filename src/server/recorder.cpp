@@ -0,0 +1,136 @@
+#include "recorder.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+
+namespace cycles_server {
+
+bool FrameRecorder::parseFormat(const std::string &name, Format &format) {
+  if (name == "png") {
+    format = Format::Png;
+  } else if (name == "raw") {
+    format = Format::Raw;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+FrameRecorder::FrameRecorder(const std::string &directory, Format format,
+                             int workerCount, std::size_t queueSize)
+    : directory(directory), format(format),
+      queueSize(std::max<std::size_t>(queueSize, 1)) {
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    spdlog::error("Could not create {}: {}", directory, error.message());
+  }
+  if (format == Format::Raw) {
+    const auto path = std::filesystem::path(directory) / "frames.rgba";
+    rawFile.open(path, std::ios::binary | std::ios::trunc);
+    if (!rawFile) {
+      spdlog::error("Could not open {}", path.string());
+    }
+  }
+  for (int i = 0; i < std::max(workerCount, 1); ++i) {
+    workers.emplace_back(&FrameRecorder::work, this);
+  }
+}
+
+FrameRecorder::~FrameRecorder() {
+  {
+    std::scoped_lock lock(queueMutex);
+    stopping = true;
+  }
+  queued.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (dropped > 0) {
+    spdlog::warn("{} frames were not recorded, the encoders did not keep up",
+                 dropped.load());
+  }
+  if (rejected > 0) {
+    spdlog::warn("{} frames were not recorded, their size was not {}x{}",
+                 rejected.load(), rawSize.x, rawSize.y);
+  }
+  spdlog::info("Recorded {} frames in {}", recorded.load(), directory);
+}
+
+bool FrameRecorder::push(const sf::Image &image) {
+  const auto size = image.getSize();
+  if (format == Format::Raw) {
+    if (rawSize == sf::Vector2u()) {
+      rawSize = size;
+      spdlog::info("Recording frames of {}x{} pixels", size.x, size.y);
+    } else if (size != rawSize) {
+      // Such as when the window is resized
+      ++rejected;
+      return false;
+    }
+  }
+  const auto *pixels = image.getPixelsPtr();
+  std::vector<sf::Uint8> buffer;
+  {
+    std::scoped_lock lock(queueMutex);
+    if (queue.size() >= queueSize) {
+      ++dropped;
+      return false;
+    }
+    if (!spareBuffers.empty()) {
+      buffer = std::move(spareBuffers.back());
+      spareBuffers.pop_back();
+    }
+  }
+  // Copied without the lock so that the workers are not stopped. Frames are
+  // only pushed by the thread that draws them, the queue has not grown
+  buffer.assign(pixels, pixels + std::size_t(size.x) * size.y * 4);
+  {
+    std::scoped_lock lock(queueMutex);
+    queue.push_back({nextNumber++, size, std::move(buffer)});
+  }
+  queued.notify_one();
+  return true;
+}
+
+void FrameRecorder::work() {
+  while (true) {
+    Frame frame;
+    {
+      std::unique_lock lock(queueMutex);
+      queued.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      frame = std::move(queue.front());
+      queue.pop_front();
+    }
+    save(frame);
+    ++recorded;
+    std::scoped_lock lock(queueMutex);
+    spareBuffers.push_back(std::move(frame.pixels));
+  }
+}
+
+void FrameRecorder::save(const Frame &frame) {
+  if (format == Format::Raw) {
+    const std::streamoff frameBytes = frame.pixels.size();
+    std::scoped_lock lock(rawMutex);
+    rawFile.seekp(frame.number * frameBytes);
+    rawFile.write(reinterpret_cast<const char *>(frame.pixels.data()),
+                  frameBytes);
+    return;
+  }
+  char name[32];
+  std::snprintf(name, sizeof(name), "frame_%06llu.png",
+                static_cast<unsigned long long>(frame.number));
+  sf::Image image;
+  image.create(frame.size.x, frame.size.y, frame.pixels.data());
+  const auto path = std::filesystem::path(directory) / name;
+  if (!image.saveToFile(path.string())) {
+    spdlog::error("Could not save {}", path.string());
+  }
+}
+
+} // namespace cycles_server
@@ -0,0 +1,73 @@
+#pragma once
+#include <SFML/Graphics.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cycles_server {
+
+// Saves the frames drawn by a GameRenderer to a directory, as numbered PNG
+// images or one after the other in a file of raw RGBA pixels. The frames
+// are encoded by a pool of threads fed by a bounded queue, frames that do
+// not fit in it are dropped so that recording never makes the renderer wait
+class FrameRecorder {
+public:
+  enum class Format { Png, Raw };
+
+  // Returns false if the name is not a known format
+  static bool parseFormat(const std::string &name, Format &format);
+
+  FrameRecorder(const std::string &directory, Format format, int workers,
+                std::size_t queueSize);
+
+  // Saves the frames still queued
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder &) = delete;
+  FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+  // Queues a copy of the image, returns false if it was dropped. Raw frames
+  // must all have the size of the first one, the others are rejected
+  bool push(const sf::Image &image);
+
+  std::uint64_t getRecordedFrames() const { return recorded; }
+  std::uint64_t getDroppedFrames() const { return dropped; }
+  std::uint64_t getRejectedFrames() const { return rejected; }
+
+private:
+  struct Frame {
+    std::uint64_t number;
+    sf::Vector2u size;
+    std::vector<sf::Uint8> pixels;
+  };
+
+  const std::string directory;
+  const Format format;
+  const std::size_t queueSize;
+  std::deque<Frame> queue;
+  std::vector<std::vector<sf::Uint8>> spareBuffers; // Of saved frames
+  std::mutex queueMutex;
+  std::condition_variable queued;
+  bool stopping = false;
+  std::uint64_t nextNumber = 0;
+  // Raw frames are written at the place of their number, so they all have
+  // the size of the first one. Only used by the thread that pushes
+  std::ofstream rawFile;
+  std::mutex rawMutex;
+  sf::Vector2u rawSize;
+  std::atomic<std::uint64_t> recorded = 0;
+  std::atomic<std::uint64_t> dropped = 0;
+  std::atomic<std::uint64_t> rejected = 0;
+  std::vector<std::thread> workers;
+
+  void work();
+  void save(const Frame &frame);
+};
+
+} // namespace cycles_server
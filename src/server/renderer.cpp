@@ -1,6 +1,10 @@
 #include "renderer.h"
+#include "recorder.h"
 #include "resources.h"
 #include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <map>
 #include <memory>
 #include <spdlog/spdlog.h>
@@ -8,91 +12,387 @@
 
 using namespace cycles_server;
 
+namespace cycles_server::detail {
+// As many as sf::CircleShape uses by default
+constexpr int circleSegments = 30;
+
+// Appends a ring between two radii as triangles, a disc if inner is 0
+void appendRing(sf::VertexArray &vertices, sf::Vector2f center, float inner,
+                float outer, sf::Color color) {
+  static const auto directions = [] {
+    std::array<sf::Vector2f, circleSegments + 1> points;
+    for (int i = 0; i <= circleSegments; ++i) {
+      const float angle = 2 * 3.14159265f * i / circleSegments;
+      points[i] = sf::Vector2f(std::cos(angle), std::sin(angle));
+    }
+    return points;
+  }();
+  for (int i = 0; i < circleSegments; ++i) {
+    const auto &first = directions[i];
+    const auto &second = directions[i + 1];
+    vertices.append(sf::Vertex(center + first * outer, color));
+    vertices.append(sf::Vertex(center + second * outer, color));
+    vertices.append(sf::Vertex(center + first * inner, color));
+    if (inner > 0) {
+      vertices.append(sf::Vertex(center + first * inner, color));
+      vertices.append(sf::Vertex(center + second * outer, color));
+      vertices.append(sf::Vertex(center + second * inner, color));
+    }
+  }
+}
+
+// Appends the two triangles of a glyph, as sf::Text lays it out
+void appendGlyph(std::vector<sf::Vertex> &vertices, sf::Vector2f position,
+                 const sf::Glyph &glyph, float outlineThickness) {
+  const float padding = 1;
+  const float left = glyph.bounds.left - padding - outlineThickness;
+  const float top = glyph.bounds.top - padding - outlineThickness;
+  const float right = glyph.bounds.left + glyph.bounds.width + padding -
+                      outlineThickness;
+  const float bottom = glyph.bounds.top + glyph.bounds.height + padding -
+                       outlineThickness;
+  const float u1 = glyph.textureRect.left - padding;
+  const float v1 = glyph.textureRect.top - padding;
+  const float u2 = glyph.textureRect.left + glyph.textureRect.width + padding;
+  const float v2 = glyph.textureRect.top + glyph.textureRect.height + padding;
+  const sf::Vertex topLeft(position + sf::Vector2f(left, top), {u1, v1});
+  const sf::Vertex topRight(position + sf::Vector2f(right, top), {u2, v1});
+  const sf::Vertex bottomLeft(position + sf::Vector2f(left, bottom), {u1, v2});
+  const sf::Vertex bottomRight(position + sf::Vector2f(right, bottom),
+                               {u2, v2});
+  vertices.insert(vertices.end(), {topLeft, topRight, bottomLeft, bottomLeft,
+                                   topRight, bottomRight});
+}
+} // namespace cycles_server::detail
+
 void PostProcess::create(sf::Vector2i windowSize) {
   if (!sf::Shader::isAvailable()) {
     spdlog::critical("Shaders are not available in this system. Please run "
                      "again without post processing enabled.");
     exit(1);
   }
-  auto postProcessShaderSource =
-      cycles_resources::getResourceFile("resources/shaders/postprocess.frag");
-  postProcessShader.loadFromMemory(std::string(postProcessShaderSource.begin(),
-                                               postProcessShaderSource.end()),
-                                   sf::Shader::Fragment);
-  auto bloomShaderSource =
-      cycles_resources::getResourceFile("resources/shaders/bloom.frag");
-  bloomShader.loadFromMemory(
-      std::string(bloomShaderSource.begin(), bloomShaderSource.end()),
-      sf::Shader::Fragment);
-  if (!postProcessShader.isAvailable()) {
-    spdlog::critical("Shader not available");
-    exit(1);
-  }
-  if (!bloomShader.isAvailable()) {
-    spdlog::critical("Bloom shader not available");
-    exit(1);
+  auto load = [](sf::Shader &shader, const std::string &name) {
+    auto source = cycles_resources::getResourceFile("resources/shaders/" + name);
+    if (!shader.loadFromMemory(std::string(source.begin(), source.end()),
+                               sf::Shader::Fragment)) {
+      spdlog::critical("Shader {} not available", name);
+      exit(1);
+    }
+  };
+  load(downsampleShader, "downsample.frag");
+  load(upsampleShader, "upsample.frag");
+  load(bloomShader, "bloom.frag");
+  auto size = windowSize;
+  for (auto &level : levels) {
+    size = sf::Vector2i(std::max(size.x / 2, 1), std::max(size.y / 2, 1));
+    level.create(size.x, size.y);
+    level.setSmooth(true);
   }
-  renderTexture.create(windowSize.x, windowSize.y);
-  renderTexture.setSmooth(true);
-  channel1.create(windowSize.x, windowSize.y);
-  channel1.setSmooth(true);
 }
 
-void PostProcess::apply(sf::RenderWindow &window, sf::RenderTexture &channel0) {
-  auto windowSize = sf::Glsl::Vec2(window.getSize().x, window.getSize().y);
-  postProcessShader.setUniform("iResolution", windowSize);
-  bloomShader.setUniform("iResolution", windowSize);
-  renderTexture.clear(sf::Color::Black);
-  channel1.clear(sf::Color::Black);
-  sf::RectangleShape bkg(windowSize);
-  bkg.setFillColor(sf::Color::Black);
-  renderTexture.draw(bkg);
-  channel1.draw(bkg);
-  postProcessShader.setUniform("iChannel0", channel0.getTexture());
-  channel1.draw(sf::Sprite(channel0.getTexture()), &postProcessShader);
-  channel1.display();
+// Draws the whole source over the whole target through the shader
+void PostProcess::resample(const sf::Texture &source, sf::RenderTexture &target,
+                           sf::Shader &shader, const sf::BlendMode &blendMode) {
+  const auto sourceSize = sf::Vector2f(source.getSize());
+  const auto targetSize = sf::Vector2f(target.getSize());
+  shader.setUniform("source", sf::Shader::CurrentTexture);
+  shader.setUniform("texelSize",
+                    sf::Glsl::Vec2(1 / sourceSize.x, 1 / sourceSize.y));
+  sf::Sprite sprite(source);
+  sprite.setScale(targetSize.x / sourceSize.x, targetSize.y / sourceSize.y);
+  sf::RenderStates states(blendMode);
+  states.shader = &shader;
+  target.draw(sprite, states);
+  target.display();
+}
+
+void PostProcess::apply(sf::RenderTarget &target, sf::RenderTexture &channel0) {
+  // How much each level of the pyramid adds to the bloom
+  constexpr std::array<float, 3> weights = {1.0f, 1.3f, 1.6f};
+  constexpr float totalWeight = weights[0] + weights[1] + weights[2];
+  // The first level is scaled so that the sum of the levels fits in it
+  const sf::Texture *source = &channel0.getTexture();
+  for (std::size_t i = 0; i < levels.size(); ++i) {
+    downsampleShader.setUniform("prefilter", i == 0);
+    downsampleShader.setUniform("scale", i == 0 ? weights[0] / totalWeight : 1);
+    resample(*source, levels[i], downsampleShader, sf::BlendNone);
+    source = &levels[i].getTexture();
+  }
+  for (std::size_t i = levels.size() - 1; i > 0; --i) {
+    upsampleShader.setUniform("weight", weights[i] / weights[i - 1]);
+    resample(levels[i].getTexture(), levels[i - 1], upsampleShader,
+             sf::BlendAdd);
+  }
+  auto targetSize = sf::Glsl::Vec2(target.getSize().x, target.getSize().y);
+  bloomShader.setUniform("iResolution", targetSize);
   bloomShader.setUniform("iChannel0", channel0.getTexture());
-  bloomShader.setUniform("iChannel1", channel1.getTexture());
-  window.draw(sf::Sprite(renderTexture.getTexture()), &bloomShader);
+  bloomShader.setUniform("iChannel1", levels[0].getTexture());
+  target.draw(sf::Sprite(channel0.getTexture()), &bloomShader);
+}
+
+sf::IntRect Camera::getVisibleCells() const {
+  const auto end = topLeft + areaSize / getCellSize();
+  const int left = std::max(0, static_cast<int>(std::floor(topLeft.x)));
+  const int top = std::max(0, static_cast<int>(std::floor(topLeft.y)));
+  const int right = std::min(gridSize.x, static_cast<int>(std::ceil(end.x)));
+  const int bottom = std::min(gridSize.y, static_cast<int>(std::ceil(end.y)));
+  return sf::IntRect(left, top, std::max(right - left, 0),
+                     std::max(bottom - top, 0));
+}
+
+void Camera::clamp() {
+  // Grids smaller than the game area stay in its top left corner
+  auto clampAxis = [](float &start, float shown, int cells) {
+    start = shown >= cells ? 0 : std::clamp(start, 0.f, cells - shown);
+  };
+  const auto shown = areaSize / getCellSize();
+  clampAxis(topLeft.x, shown.x, gridSize.x);
+  clampAxis(topLeft.y, shown.y, gridSize.y);
+}
+
+void Camera::update(const Snapshot &snapshot) {
+  gridSize = sf::Vector2i(snapshot.gridWidth, snapshot.gridHeight);
+  for (const auto &player : snapshot.players) {
+    if (player.id == followed) {
+      topLeft = sf::Vector2f(player.position) + sf::Vector2f(0.5f, 0.5f) -
+                areaSize / getCellSize() / 2.f;
+    }
+  }
+  clamp();
+}
+
+void Camera::pan(sf::Vector2f pixels) {
+  followed = -1;
+  topLeft -= pixels / getCellSize();
+  clamp();
+}
+
+void Camera::zoomAt(float factor, sf::Vector2f point) {
+  const auto cell = topLeft + (point - origin) / getCellSize();
+  zoom = std::clamp(zoom * factor, 1.f, 64.f);
+  topLeft = cell - (point - origin) / getCellSize();
+  clamp();
+}
+
+bool Camera::handleEvent(const sf::Event &event,
+                         const std::vector<cycles::Player> &players) {
+  switch (event.type) {
+  case sf::Event::MouseWheelScrolled:
+    zoomAt(std::pow(1.25f, event.mouseWheelScroll.delta),
+           sf::Vector2f(event.mouseWheelScroll.x, event.mouseWheelScroll.y));
+    return true;
+  case sf::Event::MouseButtonPressed:
+    dragging = event.mouseButton.button == sf::Mouse::Left;
+    dragPosition = sf::Vector2i(event.mouseButton.x, event.mouseButton.y);
+    return false;
+  case sf::Event::MouseButtonReleased:
+    dragging = false;
+    return false;
+  case sf::Event::MouseMoved: {
+    if (!dragging) {
+      return false;
+    }
+    const sf::Vector2i position(event.mouseMove.x, event.mouseMove.y);
+    pan(sf::Vector2f(position - dragPosition));
+    dragPosition = position;
+    return true;
+  }
+  case sf::Event::KeyPressed:
+    break;
+  default:
+    return false;
+  }
+  const float step = areaSize.x / 10;
+  switch (event.key.code) {
+  case sf::Keyboard::Left:
+    pan(sf::Vector2f(step, 0));
+    return true;
+  case sf::Keyboard::Right:
+    pan(sf::Vector2f(-step, 0));
+    return true;
+  case sf::Keyboard::Up:
+    pan(sf::Vector2f(0, step));
+    return true;
+  case sf::Keyboard::Down:
+    pan(sf::Vector2f(0, -step));
+    return true;
+  case sf::Keyboard::F: {
+    // The next player by id, or none after the last one
+    auto next = std::find_if(players.begin(), players.end(),
+                             [this](const auto &player) {
+                               return player.id > followed;
+                             });
+    followed = next == players.end() ? -1 : next->id;
+    if (followed >= 0 && zoom == 1) {
+      zoomAt(4, origin + areaSize / 2.f);
+    }
+    return true;
+  }
+  case sf::Keyboard::Home:
+    followed = -1;
+    zoom = 1;
+    topLeft = sf::Vector2f();
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The vertices of a label start at the origin, with the colours of the
+// outline and the fill
+void NameLabels::layout(Label &label) {
+  constexpr float outlineThickness = 2;
+  label.vertices.clear();
+  for (float thickness : {outlineThickness, 0.f}) {
+    const auto color = thickness > 0 ? sf::Color::Black : sf::Color::White;
+    const auto first = label.vertices.size();
+    sf::Vector2f pen(0, characterSize);
+    sf::Uint32 previous = 0;
+    for (unsigned char c : label.name) {
+      pen.x += font.getKerning(previous, c, characterSize);
+      previous = c;
+      if (c == '\n') {
+        pen = sf::Vector2f(0, pen.y + font.getLineSpacing(characterSize));
+        continue;
+      }
+      const auto &glyph = font.getGlyph(c, characterSize, false, thickness);
+      if (c != ' ' && c != '\t') {
+        detail::appendGlyph(label.vertices, pen, glyph, thickness);
+      }
+      pen.x += glyph.advance;
+    }
+    for (auto i = first; i < label.vertices.size(); ++i) {
+      label.vertices[i].color = color;
+    }
+  }
+}
+
+void NameLabels::update(const std::vector<cycles::Player> &players,
+                        const Camera &camera) {
+  vertices.clear();
+  const auto visible = camera.getVisibleCells();
+  for (const auto &player : players) {
+    if (!visible.contains(player.position)) {
+      continue;
+    }
+    auto &label = labels[player.id];
+    // Ids are given again in every match, maybe to another name
+    if (label.name != player.name || label.vertices.empty()) {
+      label.name = player.name;
+      layout(label);
+    }
+    const auto position =
+        camera.toScreen(sf::Vector2f(player.position)) - sf::Vector2f(20, 20);
+    for (auto vertex : label.vertices) {
+      vertex.position += position;
+      vertices.append(vertex);
+    }
+  }
+}
+
+void NameLabels::draw(sf::RenderTarget &target) {
+  target.draw(vertices, sf::RenderStates(&font.getTexture(characterSize)));
 }
 
 // Rendering Logic
-GameRenderer::GameRenderer(Configuration conf)
-    : window(sf::VideoMode(conf.gameWidth,
-                           conf.gameHeight + conf.gameBannerHeight),
-             "Cycles++"),
-      conf(conf) {
-  window.setFramerateLimit(60);
+GameRenderer::GameRenderer(Configuration conf, bool offscreen)
+    : conf(conf), offscreen(offscreen),
+      camera(sf::Vector2f(0, conf.gameBannerHeight),
+             sf::Vector2f(conf.gameWidth, conf.gameHeight), conf.cellSize) {
+  const sf::Vector2u size(conf.gameWidth,
+                          conf.gameHeight + conf.gameBannerHeight);
+  if (offscreen) {
+    // Still needs an OpenGL context, without a display it can come from
+    // software rendering in a virtual framebuffer such as xvfb-run
+    if (!offscreenTarget.create(size.x, size.y)) {
+      spdlog::critical("Could not create the offscreen target");
+      exit(1);
+    }
+    target = &offscreenTarget;
+  } else {
+    window.create(sf::VideoMode(size.x, size.y), "Cycles++");
+    window.setFramerateLimit(maxFramerate);
+    target = &window;
+  }
   try {
     auto fs = cycles_resources::getResourceFile("resources/SAIBA-45.ttf");
     font.loadFromMemory(fs.begin(), fs.size());
   } catch (const std::runtime_error &e) {
     spdlog::warn("No font loaded. Text rendering may not work correctly.");
   }
-  renderTexture.create(window.getSize().x, window.getSize().y);
+  frameText = sf::Text("", font, 22);
+  frameText.setPosition(10, 10);
+  frameText.setFillColor(sf::Color::White);
+  playersText = sf::Text("Players: 0", font, 22);
+  playersText.setPosition(10, 40);
+  playersText.setFillColor(sf::Color::White);
+  gameOverText = sf::Text("Game Over", font, 60);
+  gameOverText.setOutlineThickness(3);
+  gameOverText.setOutlineColor(sf::Color::White);
+  gameOverText.setFillColor(sf::Color::Black);
+  gameOverText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 - 30);
+  winnerText = sf::Text("", font, 40);
+  winnerText.setFillColor(sf::Color::Black);
+  winnerText.setOutlineThickness(3);
+  winnerText.setOutlineColor(sf::Color::White);
+  winnerText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 + 30);
+  splashText = sf::Text("Waiting for players\npress SPACE to start", font, 30);
+  splashText.setFillColor(sf::Color::Black);
+  splashText.setOutlineThickness(2);
+  splashText.setOutlineColor(sf::Color::White);
+  splashText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 - 30);
+  if (!conf.recordDirectory.empty()) {
+    FrameRecorder::Format format;
+    if (!FrameRecorder::parseFormat(conf.recordFormat, format)) {
+      spdlog::critical("Unknown recordFormat {}, it can be png or raw",
+                       conf.recordFormat);
+      exit(1);
+    }
+    recorder = std::make_unique<FrameRecorder>(
+        conf.recordDirectory, format, conf.recordWorkers, conf.recordQueue);
+    spdlog::info("Recording the frames in {}", conf.recordDirectory);
+  }
+  renderTexture.create(size.x, size.y);
+  if (sf::Shader::isAvailable()) {
+    auto gridShaderSource =
+        cycles_resources::getResourceFile("resources/shaders/grid.frag");
+    useGridTexture = gridShader.loadFromMemory(
+        std::string(gridShaderSource.begin(), gridShaderSource.end()),
+        sf::Shader::Fragment);
+  }
+  if (!useGridTexture) {
+    spdlog::warn("Shaders are not available, drawing the grid cell by cell");
+  }
   if (conf.enablePostProcessing) {
     postProcess = std::make_unique<PostProcess>();
-    postProcess->create(sf::Vector2i(window.getSize().x, window.getSize().y));
+    postProcess->create(sf::Vector2i(size.x, size.y));
   }
 }
 
-void GameRenderer::render(std::shared_ptr<Game> game) {
-  window.clear(sf::Color::Black);
+// Defined here, where FrameRecorder is complete
+GameRenderer::~GameRenderer() = default;
+
+bool GameRenderer::render(const Snapshot &snapshot) {
+  if (!needsDrawing(snapshot, false)) {
+    return false;
+  }
+  target->clear(sf::Color::Black);
   // // Draw grid
   // sf::RectangleShape cell(sf::Vector2f(conf.cellSize - 1, conf.cellSize -
   // 1)); cell.setFillColor(sf::Color::Black); for (int y = 0; y <
   // conf.gridHeight; ++y) {
   //   for (int x = 0; x < conf.gridWidth; ++x) {
   // 	cell.setPosition(x * conf.cellSize, y * conf.cellSize);
-  // 	window.draw(cell);
+  // 	target->draw(cell);
   //   }
   // }
-  renderPlayers(game);
-  if (game->isGameOver()) {
-    renderGameOver(game);
+  renderPlayers(snapshot);
+  if (snapshot.gameOver) {
+    renderGameOver(snapshot);
   }
-  renderBanner(game);
-  window.display();
+  renderBanner(snapshot);
+  present();
+  return true;
 }
 
 void GameRenderer::handleEvents(
@@ -102,119 +402,310 @@ void GameRenderer::handleEvents(
     if (event.type == sf::Event::Closed) {
       window.close();
     }
+    // The contents of the window may have been lost
+    if (event.type == sf::Event::Resized ||
+        event.type == sf::Event::GainedFocus) {
+      redraw = true;
+    }
     if (event.type == sf::Event::KeyPressed &&
         event.key.code == sf::Keyboard::Escape) {
       window.close();
     }
+    if (camera.handleEvent(event, drawn.players)) {
+      redraw = true;
+    }
     for (auto &extraEvent : extraEventsHandlers) {
       extraEvent(event);
     }
   }
 }
 
-void GameRenderer::renderPlayers(std::shared_ptr<Game> game) {
-  const int offset_y = conf.gameBannerHeight + 0;
-  const int offset_x = 0;
-  auto cellSize = conf.cellSize;
-  auto windowSize = sf::Glsl::Vec2(window.getSize().x, window.getSize().y);
-  renderTexture.clear(sf::Color::Black);
-  sf::RectangleShape bkg(windowSize);
-  bkg.setFillColor(sf::Color::Black);
-  renderTexture.draw(bkg);
+void GameRenderer::present() {
+  if (offscreen) {
+    offscreenTarget.display();
+    if (recorder) {
+      recorder->push(offscreenTarget.getTexture().copyToImage());
+    }
+    return;
+  }
+  if (recorder) {
+    // The back buffer is undefined once it is displayed
+    if (capture.getSize() != window.getSize()) {
+      capture.create(window.getSize().x, window.getSize().y);
+    }
+    capture.update(window);
+    recorder->push(capture.copyToImage());
+  }
+  window.display();
+}
 
-  for (const auto &[id, player] : game->getPlayers()) {
-    sf::CircleShape playerShape(cellSize);
+void GameRenderer::renderPlayers(const Snapshot &snapshot) {
+  camera.update(snapshot);
+  const auto visible = camera.getVisibleCells();
+  const auto cellSize = camera.getCellSize();
+  renderTexture.clear(sf::Color::Black);
+  renderTails(snapshot, visible);
+  heads.clear();
+  // Heads just outside the view still reach into it
+  const sf::IntRect nearby(visible.left - 1, visible.top - 1,
+                           visible.width + 2, visible.height + 2);
+  for (const auto &player : snapshot.players) {
+    if (!nearby.contains(player.position)) {
+      continue;
+    }
+    // The circles are twice as wide as a cell
+    const auto center = camera.toScreen(sf::Vector2f(player.position) +
+                                        sf::Vector2f(0.5f, 0.5f));
     // Make the head of the player darker
     auto darkerColor = player.color;
     darkerColor.r = darkerColor.r * 0.8;
     darkerColor.g = darkerColor.g * 0.8;
     darkerColor.b = darkerColor.b * 0.8;
-    playerShape.setFillColor(darkerColor);
-    playerShape.setPosition(
-        (player.position.x) * cellSize - cellSize / 2 + offset_x,
-        (player.position.y) * cellSize - cellSize / 2 + offset_y);
-    renderTexture.draw(playerShape);
+    detail::appendRing(heads, center, 0, cellSize, darkerColor);
     // Add a border to the head
-    sf::CircleShape borderShape(cellSize + 1);
-    borderShape.setFillColor(sf::Color::Transparent);
-    borderShape.setOutlineThickness(3);
-    borderShape.setOutlineColor(player.color);
-    borderShape.setPosition(
-        (player.position.x) * cellSize - cellSize / 2 - 1 + offset_x,
-        (player.position.y) * cellSize - cellSize / 2 - 1 + offset_y);
-    renderTexture.draw(borderShape);
-    // Draw tail
-    for (auto tail : player.tail) {
-      sf::RectangleShape tailShape(sf::Vector2f(cellSize, cellSize));
-      tailShape.setFillColor(player.color);
-      tailShape.setPosition(tail.x * cellSize + offset_x,
-                            tail.y * cellSize + offset_y);
-      renderTexture.draw(tailShape);
-    }
+    detail::appendRing(heads, center, cellSize + 1, cellSize + 4,
+                       player.color);
   }
+  renderTexture.draw(heads);
   renderTexture.display();
   if (postProcess)
-    postProcess->apply(window, renderTexture);
+    postProcess->apply(*target, renderTexture);
   else
-    window.draw(sf::Sprite(renderTexture.getTexture()));
-  for (const auto &[id, player] : game->getPlayers()) {
-    sf::Text nameText(player.name, font, 30);
-    nameText.setFillColor(sf::Color::White);
-    nameText.setOutlineThickness(2);
-    nameText.setOutlineColor(sf::Color::Black);
-    nameText.setPosition(player.position.x * cellSize - 20 + offset_x,
-                         player.position.y * cellSize - 20 + offset_y);
-    window.draw(nameText);
+    target->draw(sf::Sprite(renderTexture.getTexture()));
+  nameLabels.update(snapshot.players, camera);
+  nameLabels.draw(*target);
+}
+
+// The tails are the occupied cells of the grid, only the visible ones are
+// drawn
+void GameRenderer::renderTails(const Snapshot &snapshot, sf::IntRect visible) {
+  if (snapshot.grid.empty()) {
+    return;
+  }
+  const sf::Vector2f first(visible.left, visible.top);
+  const sf::Vector2f last(visible.left + visible.width,
+                          visible.top + visible.height);
+  if (useGridTexture && updateGridTexture(snapshot, visible)) {
+    // Texture coordinates are in texels, four cells wide
+    const auto topLeft = camera.toScreen(first);
+    const auto bottomRight = camera.toScreen(last);
+    tails.resize(4);
+    tails[0] = sf::Vertex(topLeft, sf::Vector2f(first.x / 4, first.y));
+    tails[1] = sf::Vertex(sf::Vector2f(bottomRight.x, topLeft.y),
+                          sf::Vector2f(last.x / 4, first.y));
+    tails[2] = sf::Vertex(bottomRight, sf::Vector2f(last.x / 4, last.y));
+    tails[3] = sf::Vertex(sf::Vector2f(topLeft.x, bottomRight.y),
+                          sf::Vector2f(first.x / 4, last.y));
+    gridShader.setUniform("grid", sf::Shader::CurrentTexture);
+    gridShader.setUniform("palette", paletteTexture);
+    sf::RenderStates states(&gridTexture);
+    states.shader = &gridShader;
+    renderTexture.draw(tails, states);
+    return;
   }
+  paintCanvas(snapshot, visible);
+  renderTexture.draw(sf::Sprite(canvas.getTexture()));
 }
 
-void GameRenderer::renderGameOver(std::shared_ptr<Game> game) {
-  sf::Text gameOverText("Game Over", font, 60);
-  gameOverText.setOutlineThickness(3);
-  gameOverText.setOutlineColor(sf::Color::White);
-  gameOverText.setFillColor(sf::Color::Black);
-  gameOverText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 - 30);
-  if (game->getPlayers().size() > 0) {
-    auto winner = game->getPlayers().begin()->second.name;
-    sf::Text winnerText("Winner: " + winner, font, 40);
-    winnerText.setFillColor(sf::Color::Black);
-    winnerText.setOutlineThickness(3);
-    winnerText.setOutlineColor(sf::Color::White);
-    winnerText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 + 30);
-    window.draw(winnerText);
+void GameRenderer::paintCanvas(const Snapshot &snapshot, sf::IntRect visible) {
+  const int width = snapshot.gridWidth;
+  const auto cellSize = camera.getCellSize();
+  const auto origin = camera.toScreen(sf::Vector2f(0, 0));
+  // Ids are given again in every match, maybe with other colours. The
+  // colours of players that are gone are kept for the cells they leave
+  bool recolored = false;
+  for (const auto &player : snapshot.players) {
+    recolored |= canvasColors[player.id] != player.color;
+    canvasColors[player.id] = player.color;
+  }
+  canvasColors[0] = sf::Color::Black;
+  if (canvas.getSize() != renderTexture.getSize()) {
+    canvas.create(renderTexture.getSize().x, renderTexture.getSize().y);
+    recolored = true;
+  }
+  if (recolored || canvasGrid.size() != snapshot.grid.size() ||
+      origin != canvasOrigin || cellSize != canvasCellSize) {
+    canvas.clear(sf::Color::Black);
+    canvasGrid.assign(snapshot.grid.size(), 0);
+    canvasOrigin = origin;
+    canvasCellSize = cellSize;
+  }
+  const auto &colors = canvasColors;
+  tails.clear();
+  for (int y = visible.top; y < visible.top + visible.height; ++y) {
+    for (int x = visible.left; x < visible.left + visible.width; ++x) {
+      const Id id = snapshot.grid[y * width + x];
+      auto &painted = canvasGrid[y * width + x];
+      if (id == painted) {
+        continue;
+      }
+      painted = id;
+      const float left = origin.x + x * cellSize;
+      const float top = origin.y + y * cellSize;
+      tails.append(sf::Vertex(sf::Vector2f(left, top), colors[id]));
+      tails.append(sf::Vertex(sf::Vector2f(left + cellSize, top), colors[id]));
+      tails.append(
+          sf::Vertex(sf::Vector2f(left + cellSize, top + cellSize), colors[id]));
+      tails.append(sf::Vertex(sf::Vector2f(left, top + cellSize), colors[id]));
+    }
+  }
+  // The cells are replaced, not blended with what was there
+  canvas.draw(tails, sf::RenderStates(sf::BlendNone));
+  canvas.display();
+}
+
+bool GameRenderer::needsDrawing(const Snapshot &snapshot, bool splashScreen) {
+  auto samePlayer = [](const cycles::Player &a, const cycles::Player &b) {
+    return a.id == b.id && a.position == b.position && a.color == b.color &&
+           a.name == b.name;
+  };
+  // The grid only changes with the frame or the players
+  if (!redraw && splashScreen == drawnSplashScreen &&
+      snapshot.frame == drawn.frame && snapshot.gameOver == drawn.gameOver &&
+      snapshot.waitingForPlayers == drawn.waitingForPlayers &&
+      snapshot.gridWidth == drawn.gridWidth &&
+      snapshot.gridHeight == drawn.gridHeight &&
+      std::equal(snapshot.players.begin(), snapshot.players.end(),
+                 drawn.players.begin(), drawn.players.end(), samePlayer)) {
+    return false;
+  }
+  redraw = false;
+  drawnSplashScreen = splashScreen;
+  drawn.frame = snapshot.frame;
+  drawn.gameOver = snapshot.gameOver;
+  drawn.waitingForPlayers = snapshot.waitingForPlayers;
+  drawn.gridWidth = snapshot.gridWidth;
+  drawn.gridHeight = snapshot.gridHeight;
+  drawn.players = snapshot.players;
+  return true;
+}
+
+// Uploads the runs of rows that changed since the last frame, most of the
+// grid stays the same from one frame to the next
+bool GameRenderer::updateGridTexture(const Snapshot &snapshot,
+                                     sf::IntRect visible) {
+  const int width = snapshot.gridWidth;
+  const int height = snapshot.gridHeight;
+  const unsigned texelsWide = (width + 3) / 4;
+  if (gridTexture.getSize() != sf::Vector2u(texelsWide, height)) {
+    // Tall grids can go over the limit of the graphics card. create also
+    // fails if the size it pads to a power of two does, where needed
+    const auto maximumSize = sf::Texture::getMaximumSize();
+    if (texelsWide > maximumSize ||
+        static_cast<unsigned>(height) > maximumSize ||
+        !gridTexture.create(texelsWide, height) ||
+        !paletteTexture.create(256, 1)) {
+      spdlog::warn("A grid of {}x{} cells does not fit in a texture, drawing "
+                   "it cell by cell",
+                   width, height);
+      useGridTexture = false;
+      return false;
+    }
+    paletteUploaded = false;
+    uploadRows(snapshot, 0, height);
+  } else {
+    const int bottom = visible.top + visible.height;
+    for (int y = visible.top; y < bottom;) {
+      auto changed = [&](int row) {
+        const auto *cells = snapshot.grid.data() + row * width;
+        return !std::equal(cells, cells + width,
+                           uploadedGrid.data() + row * width);
+      };
+      if (!changed(y)) {
+        ++y;
+        continue;
+      }
+      const int top = y;
+      while (y < bottom && changed(y)) {
+        ++y;
+      }
+      uploadRows(snapshot, top, y);
+    }
+  }
+  // The palette has exactly the players that are opaque, so it is up to date
+  // if it has as many of them and each has its colour
+  bool samePlayers =
+      paletteUploaded && palettePlayers == snapshot.players.size();
+  for (const auto &player : snapshot.players) {
+    const auto *texel = &palette[player.id * 4];
+    samePlayers = samePlayers && texel[0] == player.color.r &&
+                  texel[1] == player.color.g && texel[2] == player.color.b &&
+                  texel[3] == 255;
+  }
+  if (!samePlayers) {
+    // Empty cells are transparent
+    palette.fill(0);
+    for (const auto &player : snapshot.players) {
+      auto *texel = &palette[player.id * 4];
+      texel[0] = player.color.r;
+      texel[1] = player.color.g;
+      texel[2] = player.color.b;
+      texel[3] = 255;
+    }
+    paletteTexture.update(palette.data());
+    palettePlayers = snapshot.players.size();
+    paletteUploaded = true;
+  }
+  return true;
+}
+
+void GameRenderer::uploadRows(const Snapshot &snapshot, int top, int bottom) {
+  const int width = snapshot.gridWidth;
+  const unsigned texelsWide = (width + 3) / 4;
+  const auto *rows = snapshot.grid.data() + top * width;
+  if (width % 4 != 0) {
+    paddedRows.assign(texelsWide * 4 * (bottom - top), 0);
+    for (int y = top; y < bottom; ++y) {
+      std::copy(&snapshot.grid[y * width], &snapshot.grid[y * width] + width,
+                &paddedRows[(y - top) * texelsWide * 4]);
+    }
+    rows = paddedRows.data();
   }
-  window.draw(gameOverText);
+  gridTexture.update(rows, texelsWide, bottom - top, 0, top);
+  uploadedGrid.resize(snapshot.grid.size());
+  std::copy(snapshot.grid.data() + top * width,
+            snapshot.grid.data() + bottom * width,
+            uploadedGrid.data() + top * width);
 }
 
-void GameRenderer::renderBanner(std::shared_ptr<Game> game) {
+void GameRenderer::renderGameOver(const Snapshot &snapshot) {
+  if (snapshot.players.size() > 0) {
+    // setString only lays the text out again if the winner changed
+    winnerText.setString("Winner: " + snapshot.players.front().name);
+    target->draw(winnerText);
+  }
+  target->draw(gameOverText);
+}
+
+void GameRenderer::renderBanner(const Snapshot &snapshot) {
   // Draw a banner at the top
   sf::RectangleShape banner(
       sf::Vector2f(conf.gameWidth, conf.gameBannerHeight - 20));
   banner.setFillColor(sf::Color::Black);
   banner.setPosition(0, 0);
-  window.draw(banner);
+  target->draw(banner);
   // Draw the frame number
-  sf::Text frameText("Frame: " + std::to_string(game->getFrame()), font, 22);
-  frameText.setPosition(10, 10);
-  frameText.setFillColor(sf::Color::White);
-  window.draw(frameText);
+  if (snapshot.frame != labelledFrame) {
+    labelledFrame = snapshot.frame;
+    frameText.setString("Frame: " + std::to_string(snapshot.frame));
+  }
+  target->draw(frameText);
   // Draw the number of players
-  sf::Text playersText("Players: " + std::to_string(game->getPlayers().size()),
-                       font, 22);
-  playersText.setPosition(10, 40);
-  playersText.setFillColor(sf::Color::White);
-  window.draw(playersText);
+  if (snapshot.players.size() != labelledPlayers) {
+    labelledPlayers = snapshot.players.size();
+    playersText.setString("Players: " + std::to_string(labelledPlayers));
+  }
+  target->draw(playersText);
 }
 
-void GameRenderer::renderSplashScreen(std::shared_ptr<Game> game) {
-  window.clear(sf::Color::Black);
-  renderPlayers(game);
-  renderBanner(game);
-  sf::Text splashText("Waiting for players\npress SPACE to start", font, 30);
-  splashText.setFillColor(sf::Color::Black);
-  splashText.setOutlineThickness(2);
-  splashText.setOutlineColor(sf::Color::White);
-  splashText.setPosition(conf.gameWidth / 2 - 150, conf.gameHeight / 2 - 30);
-  window.draw(splashText);
-  window.display();
+bool GameRenderer::renderSplashScreen(const Snapshot &snapshot) {
+  if (!needsDrawing(snapshot, true)) {
+    return false;
+  }
+  target->clear(sf::Color::Black);
+  renderPlayers(snapshot);
+  renderBanner(snapshot);
+  target->draw(splashText);
+  present();
+  return true;
 }
@@ -1,46 +1,192 @@
 #pragma once
 #include"server.h"
-#include "game_logic.h"
 #include <SFML/Graphics.hpp>
+#include <array>
 #include <functional>
+#include <map>
+#include <memory>
+#include <vector>
 
 
 namespace cycles_server{
 // Rendering Logic
 class PostProcess{
-  sf::Shader postProcessShader;
+  sf::Shader downsampleShader;
+  sf::Shader upsampleShader;
   sf::Shader bloomShader;
-  sf::RenderTexture renderTexture;
-  sf::RenderTexture channel1;
+  // The bloom pyramid at half, quarter and eighth of the resolution, each
+  // level blurred from the one above and then added back onto it
+  std::array<sf::RenderTexture, 3> levels;
+
+  void resample(const sf::Texture &source, sf::RenderTexture &target,
+                sf::Shader &shader, const sf::BlendMode &blendMode);
+
 public:
   PostProcess(){}
   void create(sf::Vector2i windowSize);
-  void apply(sf::RenderWindow &window, sf::RenderTexture &target);
+  void apply(sf::RenderTarget &target, sf::RenderTexture &channel0);
+};
+
+// The part of the grid shown in the game area of the window. At zoom 1 the
+// grid is drawn as it fits the width, closer zooms show a part of it that
+// can be panned with the mouse or the arrows, or follow a player
+class Camera {
+  sf::Vector2f origin;   // Top left corner of the game area
+  sf::Vector2f areaSize; // Of the game area
+  float baseCellSize;
+  float zoom = 1;
+  sf::Vector2f topLeft; // First cell shown, not necessarily whole
+  sf::Vector2i gridSize;
+  int followed = -1; // The id of a player, -1 to not follow any
+  bool dragging = false;
+  sf::Vector2i dragPosition;
+
+  void clamp();
+
+public:
+  Camera(sf::Vector2f origin, sf::Vector2f areaSize, float baseCellSize)
+      : origin(origin), areaSize(areaSize), baseCellSize(baseCellSize) {}
+
+  float getCellSize() const { return baseCellSize * zoom; }
+
+  sf::Vector2f toScreen(sf::Vector2f cell) const {
+    return origin + (cell - topLeft) * getCellSize();
+  }
+
+  // The cells at least partly in the game area
+  sf::IntRect getVisibleCells() const;
+
+  // Keeps the followed player in the middle and the grid in view
+  void update(const Snapshot &snapshot);
+
+  void pan(sf::Vector2f pixels);
+
+  // Keeps the cell under the given point of the window in place
+  void zoomAt(float factor, sf::Vector2f point);
+
+  // Returns true if the event moved the camera
+  bool handleEvent(const sf::Event &event,
+                   const std::vector<cycles::Player> &players);
 };
 
+// The names of the players, laid out over the glyphs of the font only when
+// a name changes and drawn together with one call
+class NameLabels {
+  struct Label {
+    std::string name;
+    std::vector<sf::Vertex> vertices; // The outline and then the fill
+  };
+  const sf::Font &font;
+  const unsigned characterSize;
+  std::map<Id, Label> labels;
+  sf::VertexArray vertices{sf::Triangles};
+
+  void layout(Label &label);
+
+public:
+  NameLabels(const sf::Font &font, unsigned characterSize)
+      : font(font), characterSize(characterSize) {}
+  // Places the label of each player in view at the top left corner of its
+  // position
+  void update(const std::vector<cycles::Player> &players,
+              const Camera &camera);
+  void draw(sf::RenderTarget &target);
+};
+
+class FrameRecorder;
+
+// Frames drawn each second at most. Loops that find nothing new to draw wait
+// as long as a frame before looking again
+constexpr int maxFramerate = 60;
+
 class GameRenderer {
   sf::RenderWindow window;
   sf::Font font;
   sf::RenderTexture renderTexture;
   const Configuration conf;
+  // Offscreen renderers draw in a texture instead of a window
+  const bool offscreen;
+  sf::RenderTexture offscreenTarget;
+  sf::RenderTarget *target = nullptr; // The window or offscreenTarget
+  // Saves what is drawn, if recordDirectory is set
+  std::unique_ptr<FrameRecorder> recorder;
+  sf::Texture capture; // The window is copied here to be saved
   std::unique_ptr<PostProcess> postProcess;
+  // Only the cells it shows are drawn
+  Camera camera;
+  // Rebuilt every frame keeping their memory, drawn with one call each
+  sf::VertexArray tails{sf::Quads};
+  sf::VertexArray heads{sf::Triangles};
+  // With shaders the grid is a texture with four cells in each texel,
+  // coloured by gridShader, and only the rows that change are uploaded
+  bool useGridTexture = false;
+  sf::Shader gridShader;
+  sf::Texture gridTexture;
+  sf::Texture paletteTexture;
+  std::vector<Id> uploadedGrid;
+  // Built again only when the players or their colours change
+  std::array<sf::Uint8, 256 * 4> palette{};
+  std::size_t palettePlayers = 0;
+  bool paletteUploaded = false;
+  std::vector<sf::Uint8> paddedRows; // When the width is not a multiple of 4
+  // Without shaders the tails are painted in a canvas that keeps them, as
+  // the camera shows them. Only the cells that change are painted again,
+  // until the camera moves
+  sf::RenderTexture canvas;
+  std::vector<Id> canvasGrid;
+  std::array<sf::Color, 256> canvasColors{};
+  sf::Vector2f canvasOrigin; // Where the camera put the first cell
+  float canvasCellSize = 0;
+  // Texts are laid out again only when their strings change
+  NameLabels nameLabels{font, 30};
+  sf::Text frameText;
+  sf::Text playersText;
+  sf::Text gameOverText;
+  sf::Text winnerText;
+  sf::Text splashText;
+  int labelledFrame = -1;
+  std::size_t labelledPlayers = 0;
+  // What the window shows, nothing is drawn again until it changes
+  Snapshot drawn;
+  bool drawnSplashScreen = false;
+  bool redraw = true;
 
 public:
-  GameRenderer(Configuration conf);
+  GameRenderer(Configuration conf, bool offscreen = false);
 
-  void render(std::shared_ptr<Game> game);
+  ~GameRenderer();
 
-  bool isOpen() const { return window.isOpen(); }
+  // Returns false if the window already showed the snapshot
+  bool render(const Snapshot &snapshot);
+
+  bool isOpen() const { return offscreen || window.isOpen(); }
 
   void handleEvents(std::vector<std::function<void(sf::Event &)>> extraEventHandlers = {});
 
-  void renderSplashScreen(std::shared_ptr<Game> game);
+  // Returns false if the window already showed the snapshot
+  bool renderSplashScreen(const Snapshot &snapshot);
 
 private:
-  void renderPlayers(std::shared_ptr<Game> game);
+  // Shows the frame drawn and hands it to the recorder
+  void present();
+
+  void renderPlayers(const Snapshot &snapshot);
+
+  void renderTails(const Snapshot &snapshot, sf::IntRect visible);
+
+  // Only the rows in view are uploaded, the others when they come into it.
+  // Returns false if the grid does not fit in a texture
+  bool updateGridTexture(const Snapshot &snapshot, sf::IntRect visible);
+
+  void uploadRows(const Snapshot &snapshot, int top, int bottom);
+
+  void paintCanvas(const Snapshot &snapshot, sf::IntRect visible);
+
+  // Remembers the snapshot, returns false if the window already shows it
+  bool needsDrawing(const Snapshot &snapshot, bool splashScreen);
 
-  void renderGameOver(std::shared_ptr<Game> game);
+  void renderGameOver(const Snapshot &snapshot);
 
-  void renderBanner(std::shared_ptr<Game> game);
+  void renderBanner(const Snapshot &snapshot);
 };
 }
@@ -0,0 +1,611 @@
+#include "room.h"
+#include <algorithm>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+namespace cycles_server {
+
+namespace detail {
+// Rooms finish their matches at the same time, the lines of their results
+// must not interleave
+std::mutex resultsMutex;
+std::mutex frameStatsMutex;
+} // namespace detail
+
+Room::Room(int index, const Configuration &conf,
+           const std::string &snapshotName, sf::Time resultTime)
+    : index(index), conf(conf), game(conf), resultTime(resultTime) {
+  publisher = std::make_unique<SnapshotPublisher>(snapshotName, conf.gridWidth,
+                                                  conf.gridHeight);
+  publishSnapshot();
+}
+
+Room::~Room() {
+  for (const auto &[id, client] : clients) {
+    client->disconnect();
+  }
+  for (const auto &waiting : waitingClients) {
+    waiting.transport->disconnect();
+  }
+  for (const auto &[observer, frameInterval] : observers) {
+    observer->disconnect();
+  }
+}
+
+int Room::getReservedPlayers() {
+  std::scoped_lock lock(joiningMutex);
+  return playerCount + static_cast<int>(joiningClients.size());
+}
+
+bool Room::willPlayAgain() const {
+  const Phase current = phase;
+  return current == Phase::Lobby ||
+         (current != Phase::Finished && !isLastMatch());
+}
+
+void Room::addClient(JoiningClient client) {
+  std::scoped_lock lock(joiningMutex);
+  joiningClients.push_back(std::move(client));
+}
+
+void Room::addObserver(std::shared_ptr<cycles::Transport> observer,
+                       sf::Uint32 frameInterval) {
+  std::scoped_lock lock(joiningMutex);
+  joiningObservers.emplace_back(observer, frameInterval);
+}
+
+void Room::step() {
+  acceptJoiningClients();
+  switch (phase) {
+  case Phase::Lobby:
+    if (readyToStart()) {
+      spdlog::info("Room {}: Match {} starts with {} players", index,
+                   matchNumber, clients.size());
+      phase = Phase::Playing;
+      // The first frame is played once the frame time passes, like the
+      // others, so that the last players to join get their color first
+      frameClock.restart();
+      inFrame = false;
+      stepFrame();
+    }
+    break;
+  case Phase::Playing:
+    stepFrame();
+    break;
+  case Phase::Result:
+    if (resultClock.getElapsedTime() > resultTime) {
+      startNextMatch();
+    }
+    break;
+  case Phase::Finished:
+    break;
+  }
+}
+
+bool Room::addWaitableSockets(sf::SocketSelector &selector) {
+  // States still to be sent are retried right away
+  if (!clientsUnsent.empty()) {
+    return false;
+  }
+  for (const auto &[id, client] : toReceive) {
+    auto *socket = client->getWaitableSocket();
+    if (socket == nullptr) {
+      return false;
+    }
+    selector.add(*socket);
+  }
+  return true;
+}
+
+void Room::acceptJoiningClients() {
+  std::vector<JoiningClient> joining;
+  std::vector<std::pair<std::shared_ptr<cycles::Transport>, sf::Uint32>>
+      joiningSpectators;
+  {
+    std::scoped_lock lock(joiningMutex);
+    if (joiningClients.empty() && joiningObservers.empty()) {
+      return;
+    }
+    // Still reserved while they are added
+    playerCount += static_cast<int>(joiningClients.size());
+    joining.swap(joiningClients);
+    joiningSpectators.swap(joiningObservers);
+  }
+  for (auto &observer : joiningSpectators) {
+    if (phase == Phase::Finished) {
+      observer.first->disconnect();
+      continue;
+    }
+    spdlog::info("Room {}: New spectator connected, one of every {} frames",
+                 index, observer.second);
+    observers.push_back(std::move(observer));
+  }
+  for (const auto &client : joining) {
+    if (phase == Phase::Lobby) {
+      joinMatch(client);
+      continue;
+    }
+    if (phase == Phase::Finished || isLastMatch()) {
+      spdlog::info("Room {}: {} arrived after the last match", index,
+                   client.name);
+      client.transport->disconnect();
+      continue;
+    }
+    // The color is only known when the next match starts, the states tell it
+    sf::Packet colorPacket;
+    const auto color = sf::Color::White;
+    colorPacket << color.r << color.g << color.b << cycles::getMonotonicTime();
+    if (client.transport->send(colorPacket) != sf::Socket::Done) {
+      spdlog::warn("Room {}: Failed to reply to client: {}", index,
+                   client.name);
+      client.transport->disconnect();
+      continue;
+    }
+    spdlog::info("Room {}: {} will play the next match", index, client.name);
+    waitingClients.push_back(client);
+  }
+  updatePlayerCount();
+  if (phase == Phase::Lobby) {
+    publishSnapshot();
+  }
+}
+
+void Room::joinMatch(const JoiningClient &client) {
+  auto id = game.addPlayer(client.name);
+  // Send color to the client
+  sf::Packet colorPacket;
+  const auto player = game.getPlayers().at(id);
+  // The server time lets the client estimate the clock offset
+  colorPacket << player.color.r << player.color.g << player.color.b
+              << cycles::getMonotonicTime();
+  if (client.transport->send(colorPacket) != sf::Socket::Done) {
+    // It would only be removed once the match starts, after being counted
+    // to start it
+    spdlog::warn("Room {}: Failed to send color to client: {}", index,
+                 client.name);
+    game.removePlayer(id);
+    client.transport->disconnect();
+    return;
+  }
+  spdlog::info("Color sent to client: {}", client.name);
+  registerClient(id, client.transport, client.name, client.viewRadius);
+  spdlog::info("Room {}: New client connected: {} with id {}", index,
+               client.name, id);
+}
+
+// The timeout does not start a match nobody joined
+bool Room::readyToStart() {
+  const int players = static_cast<int>(clients.size());
+  if (startRequested.exchange(false) && players > 0) {
+    spdlog::info("Room {}: Starting the match on request", index);
+    return true;
+  }
+  if (conf.startPlayers > 0 && players >= conf.startPlayers) {
+    spdlog::info("Room {}: {} players joined, starting the match", index,
+                 players);
+    return true;
+  }
+  if (conf.joinTimeout > 0 && players > 0 &&
+      lobbyClock.getElapsedTime() >= sf::seconds(conf.joinTimeout)) {
+    spdlog::info("Room {}: Join timeout passed, starting the match with {} "
+                 "players",
+                 index, players);
+    return true;
+  }
+  return false;
+}
+
+bool Room::isLastMatch() const {
+  return conf.matches > 0 && matchNumber >= conf.matches;
+}
+
+/**
+ * The clients of the previous match keep their connections, they are added
+ * again to the game and receive the states of the new one. Clients that
+ * joined during the previous match play too.
+ */
+void Room::startNextMatch() {
+  for (const auto &[id, client] : clients) {
+    waitingClients.push_back({client, clientNames[id], clientViewRadius[id]});
+  }
+  clients.clear();
+  clientViewRadius.clear();
+  clientNames.clear();
+  reportedDrops.clear();
+  eliminated.clear();
+  game.reset();
+  ++matchNumber;
+  matchStartFrame = frame;
+  phase = Phase::Lobby;
+  lobbyClock.restart();
+  for (const auto &waiting : waitingClients) {
+    if (waiting.transport->isConnected()) {
+      registerClient(game.addPlayer(waiting.name), waiting.transport,
+                     waiting.name, waiting.viewRadius);
+    }
+  }
+  waitingClients.clear();
+  updatePlayerCount();
+  spdlog::info("Room {}: Match {} has {} players already", index,
+               matchNumber, clients.size());
+  publishSnapshot();
+}
+
+void Room::endMatch() {
+  publishSnapshot();
+  recordResult();
+  writeFrameStats();
+  if (isLastMatch()) {
+    // Nobody else will play here, the clients can leave
+    for (const auto &[id, client] : clients) {
+      client->disconnect();
+    }
+    for (const auto &waiting : waitingClients) {
+      waiting.transport->disconnect();
+    }
+    waitingClients.clear();
+    phase = Phase::Finished;
+    spdlog::info("Room {}: No more matches", index);
+  } else {
+    phase = Phase::Result;
+    resultClock.restart();
+  }
+  updatePlayerCount();
+}
+
+void Room::publishSnapshot() {
+  game.getSnapshot(snapshot);
+  snapshot.waitingForPlayers = phase == Phase::Lobby;
+  publisher->publish(snapshot);
+}
+
+void Room::updatePlayerCount() {
+  std::scoped_lock lock(joiningMutex);
+  playerCount = phase == Phase::Finished
+                    ? 0
+                    : static_cast<int>(clients.size() + waitingClients.size());
+}
+
+// Plays the frame in steps: the states are sent and the moves received as
+// far as possible without blocking, until every player answered or the time
+// to do it is over
+void Room::stepFrame() {
+  if (!inFrame) {
+    if (frameClock.getElapsedTime().asMilliseconds() < conf.frameTime) {
+      return;
+    }
+    if (game.isGameOver()) {
+      endMatch();
+      return;
+    }
+    frameClock.restart();
+    game.setFrame(frame - matchStartFrame);
+    checkPlayers();
+    clientsUnsent = clients;
+    toReceive.clear();
+    newDirs.clear();
+    clientCommunicationClock.restart();
+    // Moves must arrive before this time, in the clock sent to clients
+    moveDeadline =
+        cycles::getMonotonicTime() + max_client_communication_time * 1000;
+    inFrame = true;
+    frameSendTime = 0;
+    frameBytesSent = 0;
+  }
+  const auto sendStart = cycles::getMonotonicTime();
+  auto successful = sendGameState();
+  frameSendTime += cycles::getMonotonicTime() - sendStart;
+  for (auto s : successful) {
+    clientsUnsent.erase(s);
+    toReceive[s] = clients[s];
+  }
+  auto succesfulrec = receiveClientInput();
+  for (auto s : succesfulrec) {
+    toReceive.erase(s.first);
+    newDirs[s.first] = s.second;
+  }
+  spdlog::debug("Server ({}): Clients unsent: {}", frame, clientsUnsent.size());
+  spdlog::debug("Server ({}): Clients to recieve: {}", frame, toReceive.size());
+  std::set<Id> timedOutPlayers;
+  if (!clientsUnsent.empty() || !toReceive.empty()) {
+    // Check for clients that have not sent input for a long time
+    if (clientCommunicationClock.getElapsedTime().asMilliseconds() <=
+        max_client_communication_time) {
+      return;
+    }
+    // Mark all remaining clients for removal
+    for (const auto &[id, client] : clientsUnsent) {
+      timedOutPlayers.insert(id);
+    }
+    for (const auto &[id, client] : toReceive) {
+      timedOutPlayers.insert(id);
+    }
+  }
+  finishFrame(timedOutPlayers);
+}
+
+void Room::finishFrame(const std::set<Id> &timedOutPlayers) {
+  inFrame = false;
+  clientsUnsent.clear();
+  toReceive.clear();
+  for (auto id : timedOutPlayers) {
+    spdlog::info("Server ({}): Client {} has not sent input for a long time",
+                 frame, id);
+    removeClient(id, false);
+    newDirs.erase(id);
+  }
+  sendToObservers();
+  const auto simulateStart = cycles::getMonotonicTime();
+  game.movePlayers(newDirs);
+  if (!conf.frameStatsFile.empty()) {
+    recordFrameStats(cycles::getMonotonicTime() - simulateStart);
+  }
+  if (frame % lag_report_interval == 0) {
+    reportLaggingClients();
+  }
+  frame++;
+  publishSnapshot();
+}
+
+void Room::registerClient(Id id, std::shared_ptr<cycles::Transport> client,
+                          const std::string &name, int viewRadius) {
+  clients[id] = client;
+  clientViewRadius[id] = std::max(viewRadius, 0);
+  clientNames[id] = name;
+}
+
+void Room::checkPlayers() {
+  // Remove clients from players that have died or disconnected
+  spdlog::debug("Server ({}): Checking players", frame);
+  auto players = game.getPlayers();
+  std::vector<Id> removed;
+  for (const auto &[id, client] : clients) {
+    bool remove = false;
+    if (players.find(id) == players.end()) {
+      spdlog::info("Room {}: Player {} has died", index, id);
+      remove = true;
+    }
+    if (!client->isConnected()) {
+      spdlog::info("Room {}: Player {} has disconnected", index, id);
+      remove = true;
+    }
+    if (remove) {
+      removed.push_back(id);
+    }
+  }
+  for (auto id : removed) {
+    removeClient(id, true);
+  }
+  const auto disconnected = std::erase_if(observers, [](const auto &observer) {
+    return !observer.first->isConnected();
+  });
+  if (disconnected > 0) {
+    spdlog::info("Room {}: {} spectators have disconnected", index,
+                 disconnected);
+  }
+}
+
+// Clients kept for the next match stay connected, and stop receiving the
+// states until it starts
+void Room::removeClient(Id id, bool keepForNextMatch) {
+  game.removePlayer(id);
+  auto client = clients.at(id);
+  eliminated.push_back(clientNames[id]);
+  if (keepForNextMatch && !isLastMatch() && client->isConnected()) {
+    waitingClients.push_back({client, clientNames[id], clientViewRadius[id]});
+  } else {
+    client->disconnect();
+  }
+  clients.erase(id);
+  clientViewRadius.erase(id);
+  clientNames.erase(id);
+  reportedDrops.erase(id);
+  updatePlayerCount();
+}
+
+// Ranks the players from the winner to the first one eliminated, and
+// appends them to the results file if there is one
+void Room::recordResult() {
+  const auto players = game.getPlayers();
+  std::vector<std::string> ranking;
+  // Eliminated in the last frame, the game loop did not remove them yet
+  for (const auto &[id, client] : clients) {
+    if (players.find(id) == players.end()) {
+      eliminated.push_back(clientNames[id]);
+    }
+  }
+  for (const auto &[id, client] : clients) {
+    if (players.find(id) != players.end()) {
+      ranking.push_back(clientNames[id]);
+    }
+  }
+  ranking.insert(ranking.end(), eliminated.rbegin(), eliminated.rend());
+  spdlog::info("Room {}: Match {} over after {} frames, winner: {}", index,
+               matchNumber, frame - matchStartFrame,
+               ranking.empty() ? "nobody" : ranking.front());
+  if (conf.resultsFile.empty()) {
+    return;
+  }
+  std::scoped_lock lock(detail::resultsMutex);
+  std::ofstream results(conf.resultsFile, std::ios::app);
+  for (std::size_t i = 0; i < ranking.size(); ++i) {
+    std::string name = ranking[i];
+    // Quoted as CSV, names may contain anything
+    for (std::size_t quote = name.find('"'); quote != std::string::npos;
+         quote = name.find('"', quote + 2)) {
+      name.insert(quote, 1, '"');
+    }
+    results << index << ',' << matchNumber << ',' << frame - matchStartFrame
+            << ',' << i + 1 << ",\"" << name << "\"\n";
+  }
+  if (!results) {
+    spdlog::error("Failed to write the results to {}", conf.resultsFile);
+  }
+}
+
+// The frame time goes from sending the first state to simulating the moves,
+// it includes waiting for the clients
+void Room::recordFrameStats(sf::Int64 simulateTime) {
+  const auto frameMicroseconds =
+      clientCommunicationClock.getElapsedTime().asMicroseconds();
+  frameStats += fmt::format("{},{},{},{},{},{},{},{}\n", index,
+                            matchNumber.load(), frame - matchStartFrame,
+                            clients.size(), frameMicroseconds, frameSendTime,
+                            simulateTime, frameBytesSent);
+}
+
+// Appends the lines of the match to the frame stats file, once the match is
+// over to keep the files out of the frames
+void Room::writeFrameStats() {
+  if (conf.frameStatsFile.empty() || frameStats.empty()) {
+    return;
+  }
+  std::scoped_lock lock(detail::frameStatsMutex);
+  std::ofstream stats(conf.frameStatsFile, std::ios::app);
+  stats << frameStats;
+  if (!stats) {
+    spdlog::error("Failed to write the frame stats to {}",
+                  conf.frameStatsFile);
+  }
+  frameStats.clear();
+}
+
+// Clients that do not read the states as fast as they are sent get only the
+// newest ones, warn about those that skipped states since the last report
+void Room::reportLaggingClients() {
+  for (const auto &[id, client] : clients) {
+    const auto &statistics = client->getStatistics();
+    auto &reported = reportedDrops[id];
+    if (statistics.messagesDropped > reported) {
+      spdlog::warn("Server ({}): Player {} is lagging, {} of {} states "
+                   "dropped, {} bytes queued",
+                   frame, id, statistics.messagesDropped,
+                   statistics.messagesSent + statistics.messagesDropped,
+                   statistics.queuedBytes);
+      reported = statistics.messagesDropped;
+    }
+  }
+}
+
+std::map<Id, Direction> Room::receiveClientInput() {
+  spdlog::debug("Server ({}): Receiving client input from {} clients", frame,
+                toReceive.size());
+  std::map<Id, Direction> successful;
+  for (const auto &[id, client] : toReceive) {
+    spdlog::debug("Server ({}): Receiving input from player {} ({})", frame,
+                  id, clientNames[id]);
+    // Sending is not blocking, finish sending the state if needed
+    client->flush();
+    std::span<const char> message;
+    auto status = client->receive(message);
+    if (status == sf::Socket::Done) {
+      sf::Packet packet;
+      packet.append(message.data(), message.size());
+      int direction;
+      packet >> direction;
+      spdlog::debug("Received direction {} from player {} ({})", direction, id,
+                    clientNames[id]);
+      successful[id] = static_cast<Direction>(direction);
+    }
+  }
+  return successful;
+}
+
+// Id is a single byte, so every row of the window is a contiguous run of
+// bytes both in the grid and in the packet
+static_assert(sizeof(Id) == 1);
+
+namespace detail {
+void appendGridWindow(sf::Packet &packet, const std::vector<Id> &grid,
+                      int gridWidth, sf::IntRect window) {
+  packet << window.left << window.top << window.width << window.height;
+  if (window.width <= 0) {
+    return;
+  }
+  for (int y = window.top; y < window.top + window.height; ++y) {
+    packet.append(&grid[y * gridWidth + window.left], window.width);
+  }
+}
+
+sf::Packet makeStateHeader(sf::Vector2i gridSize,
+                           const std::map<Id, Player> &players, int frame,
+                           sf::Int64 moveDeadline) {
+  sf::Packet header;
+  header << gridSize.x << gridSize.y;
+  header << static_cast<sf::Uint32>(players.size());
+  for (const auto &[id, player] : players) {
+    header << player.position.x << player.position.y << player.color.r
+           << player.color.g << player.color.b << player.name << id << frame;
+  }
+  header << cycles::getMonotonicTime() << moveDeadline;
+  return header;
+}
+} // namespace detail
+
+std::vector<Id> Room::sendGameState() {
+  spdlog::debug("Server ({}): Sending game state to {} clients", frame,
+                clientsUnsent.size());
+  if (clientsUnsent.empty()) {
+    return std::vector<Id>();
+  }
+  auto players = game.getPlayers();
+  const sf::Vector2i gridSize(conf.gridWidth, conf.gridHeight);
+  const auto header =
+      detail::makeStateHeader(gridSize, players, frame, moveDeadline);
+  // Clients observing the whole grid share a single packet, which in-process
+  // clients read without copying it. Windowed clients get their own
+  std::shared_ptr<sf::Packet> fullPacket;
+  std::vector<Id> successful;
+  for (const auto &[id, client] : clientsUnsent) {
+    std::shared_ptr<sf::Packet> packet;
+    const int viewRadius = clientViewRadius[id];
+    auto player = players.find(id);
+    if (viewRadius > 0 && player != players.end()) {
+      packet = std::make_shared<sf::Packet>(header);
+      detail::appendGridWindow(
+          *packet, game.getGrid(), conf.gridWidth,
+          game.getViewWindow(player->second.position, viewRadius));
+    } else {
+      if (fullPacket == nullptr) {
+        fullPacket = std::make_shared<sf::Packet>(header);
+        detail::appendGridWindow(*fullPacket, game.getGrid(), conf.gridWidth,
+                                 sf::IntRect(0, 0, conf.gridWidth,
+                                             conf.gridHeight));
+      }
+      packet = fullPacket;
+    }
+    if (client->sendLatest(packet) != sf::Socket::Done) {
+      spdlog::debug("Server ({}): Failed to send game state to player {}",
+                    frame, id);
+    } else {
+      successful.push_back(id);
+      frameBytesSent += packet->getDataSize();
+      spdlog::debug("Server ({}): Game state sent to player {}", frame, id);
+    }
+  }
+  return successful;
+}
+
+// Sent once the players are done with the frame, so that spectators never
+// delay them. Those that do not keep up only get the newest state
+void Room::sendToObservers() {
+  std::shared_ptr<sf::Packet> packet;
+  for (const auto &[observer, frameInterval] : observers) {
+    observer->flush();
+    if (frame % frameInterval != 0) {
+      continue;
+    }
+    if (packet == nullptr) {
+      packet = std::make_shared<sf::Packet>(detail::makeStateHeader(
+          sf::Vector2i(conf.gridWidth, conf.gridHeight), game.getPlayers(),
+          frame, moveDeadline));
+      detail::appendGridWindow(*packet, game.getGrid(), conf.gridWidth,
+                               sf::IntRect(0, 0, conf.gridWidth,
+                                           conf.gridHeight));
+    }
+    observer->sendLatest(packet);
+  }
+}
+
+} // namespace cycles_server
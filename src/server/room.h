@@ -0,0 +1,165 @@
+#pragma once
+#include "game_logic.h"
+#include "server.h"
+#include "snapshot.h"
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace cycles_server {
+
+// A client that sent its name and is routed to a room
+struct JoiningClient {
+  std::shared_ptr<cycles::Transport> transport;
+  std::string name;
+  int viewRadius = 0;
+};
+
+namespace detail {
+// The part of a game state that is the same for every client
+sf::Packet makeStateHeader(sf::Vector2i gridSize,
+                           const std::map<Id, Player> &players, int frame,
+                           sf::Int64 moveDeadline);
+
+// Appends the window of the grid to a game state, after its bounds
+void appendGridWindow(sf::Packet &packet, const std::vector<Id> &grid,
+                      int gridWidth, sf::IntRect window);
+} // namespace detail
+
+// Plays matches with its own Game and clients. Rooms do not block, their
+// worker threads call step as often as they can, so a few threads can run
+// many rooms. The other methods can be called from any thread.
+class Room {
+public:
+  enum class Phase {
+    Lobby,    // Accepting players until the match starts
+    Playing,  // Clients that join wait for the next match
+    Result,   // Showing the result before the next match
+    Finished, // No more matches, clients are rejected
+  };
+
+  Room(int index, const Configuration &conf, const std::string &snapshotName,
+       sf::Time resultTime);
+
+  // Disconnects every client
+  ~Room();
+
+  int getIndex() const { return index; }
+
+  Phase getPhase() const { return phase; }
+
+  // Players in the game or waiting to play, including the ones not added
+  // by the room thread yet
+  int getReservedPlayers();
+
+  // Whether clients that join now will play a match
+  bool willPlayAgain() const;
+
+  void addClient(JoiningClient client);
+
+  void addObserver(std::shared_ptr<cycles::Transport> observer,
+                   sf::Uint32 frameInterval);
+
+  // Starts the match without waiting for startPlayers or joinTimeout
+  void requestStart() { startRequested = true; }
+
+  void getSnapshot(Snapshot &snapshot) { game.getSnapshot(snapshot); }
+
+  // Advances the room without blocking
+  void step();
+
+  /**
+   * @brief Add the sockets of the clients the room is waiting for
+   *
+   * @return false if some of them cannot be waited on with a selector, so
+   * the room must be polled
+   */
+  bool addWaitableSockets(sf::SocketSelector &selector);
+
+  // Waiting for the moves of the players
+  bool isCollectingMoves() const { return inFrame; }
+
+private:
+  const int index;
+  const Configuration conf;
+  Game game;
+  std::atomic<Phase> phase = Phase::Lobby;
+  std::atomic<bool> startRequested = false;
+  const sf::Time resultTime;
+
+  // Only used by the room thread
+  std::map<Id, std::shared_ptr<cycles::Transport>> clients;
+  std::map<Id, int> clientViewRadius; // 0 means the whole grid
+  std::map<Id, std::string> clientNames;
+  // Clients eliminated from the current match or that joined during it,
+  // they play the next one
+  std::vector<JoiningClient> waitingClients;
+  std::vector<std::string> eliminated; // In the current match, in order
+  // Spectators only receive the states, with the interval they asked for
+  std::vector<std::pair<std::shared_ptr<cycles::Transport>, sf::Uint32>>
+      observers;
+  // States dropped for each client the last time they were reported
+  std::map<Id, std::uint64_t> reportedDrops;
+  std::atomic<int> playerCount = 0; // Clients and waiting clients
+
+  // Handed over by other threads
+  std::vector<JoiningClient> joiningClients;
+  std::vector<std::pair<std::shared_ptr<cycles::Transport>, sf::Uint32>>
+      joiningObservers;
+  std::mutex joiningMutex;
+
+  int frame = 0; // Keeps counting across matches
+  std::atomic<int> matchNumber = 1;
+  int matchStartFrame = 0;
+  sf::Clock lobbyClock;
+  sf::Clock resultClock;
+  std::unique_ptr<SnapshotPublisher> publisher;
+  Snapshot snapshot;
+
+  // The frame being played
+  bool inFrame = false;
+  sf::Clock frameClock;
+  sf::Clock clientCommunicationClock;
+  sf::Int64 moveDeadline = 0;
+  std::map<Id, std::shared_ptr<cycles::Transport>> clientsUnsent;
+  std::map<Id, std::shared_ptr<cycles::Transport>> toReceive;
+  std::map<Id, Direction> newDirs;
+  // Of the frame being played, for frameStatsFile
+  sf::Int64 frameSendTime = 0; // us
+  std::size_t frameBytesSent = 0;
+  std::string frameStats; // Lines of the match, written when it ends
+
+  const int max_client_communication_time = 50; // ms
+  const int lag_report_interval = 30;            // frames
+
+  void acceptJoiningClients();
+  void joinMatch(const JoiningClient &client);
+  bool readyToStart();
+  bool isLastMatch() const;
+  void startNextMatch();
+  void endMatch();
+  void publishSnapshot();
+  void updatePlayerCount();
+
+  void stepFrame();
+  void finishFrame(const std::set<Id> &timedOutPlayers);
+  void registerClient(Id id, std::shared_ptr<cycles::Transport> client,
+                      const std::string &name, int viewRadius);
+  void checkPlayers();
+  void removeClient(Id id, bool keepForNextMatch);
+  void recordResult();
+  void recordFrameStats(sf::Int64 simulateTime);
+  void writeFrameStats();
+  void reportLaggingClients();
+  std::map<Id, Direction> receiveClientInput();
+  std::vector<Id> sendGameState();
+  void sendToObservers();
+};
+
+} // namespace cycles_server
@@ -2,6 +2,8 @@
 #include "api.h"
 #include <SFML/Main.hpp>
 #include <list>
+#include <string>
+#include <vector>
 
 namespace cycles_server {
 using cycles::Direction;
@@ -16,6 +18,25 @@ struct Player {
   Player() : id(std::rand()) {}
 };
 
+// What is drawn of the game, copied out of it so that it can be drawn by
+// another thread or process while the game goes on
+struct Snapshot {
+  int frame = 0;
+  int gridWidth = 0;
+  int gridHeight = 0;
+  bool gameOver = false;
+  bool waitingForPlayers = false; // The match has not started yet
+  std::vector<cycles::Player> players; // Sorted by id
+  std::vector<Id> grid; // Row-major, 0 is an empty cell
+};
+
+// A bot compiled as a shared library, run by the server in its own thread
+struct BotConfiguration {
+  std::string library; // Path to the shared library
+  std::string name;
+  int count = 1; // Names get a suffix if there is more than one
+  std::vector<std::string> arguments; // Passed after the name
+};
 
 struct Configuration {
 
@@ -27,6 +48,27 @@ struct Configuration {
   int gameBannerHeight = 100;
   float cellSize = 10;
   bool enablePostProcessing = false;
+  // Run without a window, the match starts by itself and the server exits
+  // when it is over
+  bool headless = false;
+  int startPlayers = 0;    // Start once this many have joined, 0 to not
+  float joinTimeout = 0;   // Start after this many seconds, 0 to not
+  // Matches played back to back by the same clients, 0 to never stop
+  int matches = 1;
+  std::string resultsFile; // CSV with the ranking of every match
+  int frameTime = 33; // ms between frames, 0 to go as fast as the clients
+  // CSV with the time spent in every frame and the bytes of state sent
+  std::string frameStatsFile;
+  // Matches played at the same time, each with its own game and clients
+  int rooms = 1;
+  int workers = 0; // Threads that play the rooms, 0 for one per core
+  // Every frame drawn is saved in this directory, as png images or raw
+  // RGBA frames. Headless servers draw offscreen to record
+  std::string recordDirectory;
+  std::string recordFormat = "png";
+  int recordWorkers = 2;   // Threads that encode the frames
+  int recordQueue = 32;    // Frames waiting to be encoded, more are dropped
+  std::vector<BotConfiguration> bots;
   Configuration(std::string configPath);
 };
 } // namespace cycles_server
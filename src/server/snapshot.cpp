@@ -0,0 +1,287 @@
+#include "snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cycles_server {
+
+namespace detail {
+
+constexpr std::uint32_t snapshotMagic = 0x43594353; // "CYCS"
+constexpr std::uint32_t snapshotVersion = 1;
+constexpr std::size_t maxPlayers = 256; // Every possible Id
+constexpr std::size_t maxNameLength = 31;
+
+struct SnapshotPlayer {
+  std::uint8_t id, r, g, b;
+  std::int32_t x, y;
+  char name[maxNameLength + 1];
+};
+
+// The segment starts with this header, followed by the grid. The sequence is
+// odd while the publisher is writing, readers retry if it changed while
+// they were copying
+struct SnapshotHeader {
+  std::atomic<std::uint32_t> magic;
+  std::uint32_t version;
+  std::int32_t gridWidth;
+  std::int32_t gridHeight;
+  std::atomic<std::uint64_t> sequence;
+  std::atomic<std::uint32_t> closed;
+  std::int32_t frame;
+  std::uint32_t flags;
+  std::uint32_t playerCount;
+  SnapshotPlayer players[maxPlayers];
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+              std::atomic<std::uint32_t>::is_always_lock_free);
+
+constexpr std::uint32_t gameOverFlag = 1;
+constexpr std::uint32_t waitingForPlayersFlag = 2;
+
+std::size_t getSegmentSize(int gridWidth, int gridHeight) {
+  return sizeof(SnapshotHeader) +
+         static_cast<std::size_t>(gridWidth) * gridHeight;
+}
+
+} // namespace detail
+
+std::string getSnapshotSegmentName(unsigned short port, int room) {
+  // The first room keeps the name used by servers with a single one
+  auto name = "/cycles-snapshot-" + std::to_string(port);
+  if (room > 0) {
+    name += "-" + std::to_string(room);
+  }
+  return name;
+}
+
+#ifndef _WIN32
+
+SnapshotPublisher::SnapshotPublisher(const std::string &name, int gridWidth,
+                                     int gridHeight)
+    : name(name) {
+  // A segment left by a server that crashed is replaced, the viewers still
+  // attached to it notice it is stale
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    spdlog::error("Failed to create the snapshot segment {}", name);
+    return;
+  }
+  const auto segmentSize = detail::getSegmentSize(gridWidth, gridHeight);
+  void *mapped = MAP_FAILED;
+  if (ftruncate(fd, segmentSize) == 0) {
+    mapped = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  }
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    spdlog::error("Failed to map the snapshot segment {}", name);
+    shm_unlink(name.c_str());
+    return;
+  }
+  memory = mapped;
+  size = segmentSize;
+  auto *header = new (memory) detail::SnapshotHeader();
+  header->version = detail::snapshotVersion;
+  header->gridWidth = gridWidth;
+  header->gridHeight = gridHeight;
+  header->magic.store(detail::snapshotMagic, std::memory_order_release);
+  spdlog::info("Publishing snapshots for viewers in {}", name);
+}
+
+SnapshotPublisher::~SnapshotPublisher() {
+  if (memory == nullptr) {
+    return;
+  }
+  auto *header = static_cast<detail::SnapshotHeader *>(memory);
+  header->closed.store(1, std::memory_order_release);
+  munmap(memory, size);
+  shm_unlink(name.c_str());
+}
+
+void SnapshotPublisher::publish(const Snapshot &snapshot) {
+  if (memory == nullptr) {
+    return;
+  }
+  auto *header = static_cast<detail::SnapshotHeader *>(memory);
+  if (snapshot.gridWidth != header->gridWidth ||
+      snapshot.gridHeight != header->gridHeight) {
+    spdlog::error("The snapshot does not match the size of the segment");
+    return;
+  }
+  // Only this process writes the sequence
+  const auto sequence = header->sequence.load(std::memory_order_relaxed);
+  header->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->frame = snapshot.frame;
+  header->flags = (snapshot.gameOver ? detail::gameOverFlag : 0) |
+                  (snapshot.waitingForPlayers ? detail::waitingForPlayersFlag
+                                              : 0);
+  const auto count = std::min(snapshot.players.size(), detail::maxPlayers);
+  header->playerCount = static_cast<std::uint32_t>(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto &player = snapshot.players[i];
+    auto &target = header->players[i];
+    target.id = player.id;
+    target.r = player.color.r;
+    target.g = player.color.g;
+    target.b = player.color.b;
+    target.x = player.position.x;
+    target.y = player.position.y;
+    const auto length = std::min(player.name.size(), detail::maxNameLength);
+    std::memcpy(target.name, player.name.data(), length);
+    target.name[length] = '\0';
+  }
+  std::memcpy(static_cast<char *>(memory) + sizeof(detail::SnapshotHeader),
+              snapshot.grid.data(), snapshot.grid.size());
+  header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool SnapshotReader::attach(const std::string &name) {
+  detach();
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  void *mapped = MAP_FAILED;
+  std::size_t segmentSize = 0;
+  if (fstat(fd, &info) == 0 &&
+      static_cast<std::size_t>(info.st_size) >=
+          sizeof(detail::SnapshotHeader)) {
+    segmentSize = info.st_size;
+    mapped = mmap(nullptr, segmentSize, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  const auto *header = static_cast<const detail::SnapshotHeader *>(mapped);
+  // The server may still be initializing it
+  if (header->magic.load(std::memory_order_acquire) != detail::snapshotMagic ||
+      header->version != detail::snapshotVersion || header->gridWidth <= 0 ||
+      header->gridHeight <= 0 ||
+      detail::getSegmentSize(header->gridWidth, header->gridHeight) !=
+          segmentSize) {
+    munmap(mapped, segmentSize);
+    return false;
+  }
+  memory = mapped;
+  size = segmentSize;
+  lastSequence = 0;
+  idleClock.restart();
+  return true;
+}
+
+void SnapshotReader::detach() {
+  if (memory != nullptr) {
+    munmap(memory, size);
+    memory = nullptr;
+  }
+}
+
+bool SnapshotReader::read(Snapshot &snapshot) {
+  if (memory == nullptr) {
+    return false;
+  }
+  const auto *header = static_cast<const detail::SnapshotHeader *>(memory);
+  const char *grid =
+      static_cast<const char *>(memory) + sizeof(detail::SnapshotHeader);
+  // The publisher writes a snapshot in microseconds, so a few attempts are
+  // enough
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    const auto sequence = header->sequence.load(std::memory_order_acquire);
+    if (sequence == lastSequence) {
+      return false;
+    }
+    if (sequence % 2 == 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    snapshot.frame = header->frame;
+    snapshot.gridWidth = header->gridWidth;
+    snapshot.gridHeight = header->gridHeight;
+    snapshot.gameOver = (header->flags & detail::gameOverFlag) != 0;
+    snapshot.waitingForPlayers =
+        (header->flags & detail::waitingForPlayersFlag) != 0;
+    const auto count =
+        std::min<std::size_t>(header->playerCount, detail::maxPlayers);
+    snapshot.players.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto &source = header->players[i];
+      auto &player = snapshot.players[i];
+      player.id = source.id;
+      player.color = sf::Color(source.r, source.g, source.b);
+      player.position = sf::Vector2i(source.x, source.y);
+      player.name.assign(source.name,
+                         strnlen(source.name, detail::maxNameLength));
+    }
+    snapshot.grid.resize(static_cast<std::size_t>(header->gridWidth) *
+                         header->gridHeight);
+    std::memcpy(snapshot.grid.data(), grid, snapshot.grid.size());
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->sequence.load(std::memory_order_relaxed) == sequence) {
+      lastSequence = sequence;
+      idleClock.restart();
+      return true;
+    }
+  }
+  return false;
+}
+
+int SnapshotReader::getGridWidth() const {
+  return static_cast<const detail::SnapshotHeader *>(memory)->gridWidth;
+}
+
+int SnapshotReader::getGridHeight() const {
+  return static_cast<const detail::SnapshotHeader *>(memory)->gridHeight;
+}
+
+bool SnapshotReader::isStale(sf::Time timeout) const {
+  if (memory == nullptr) {
+    return true;
+  }
+  const auto *header = static_cast<const detail::SnapshotHeader *>(memory);
+  return header->closed.load(std::memory_order_acquire) != 0 ||
+         idleClock.getElapsedTime() > timeout;
+}
+
+#else
+
+// Shared memory is only implemented for POSIX systems, the server runs
+// without viewers elsewhere
+SnapshotPublisher::SnapshotPublisher(const std::string &name, int, int)
+    : name(name) {}
+
+SnapshotPublisher::~SnapshotPublisher() {}
+
+void SnapshotPublisher::publish(const Snapshot &) {}
+
+bool SnapshotReader::attach(const std::string &) {
+  spdlog::error("Viewers are not supported in this system");
+  return false;
+}
+
+void SnapshotReader::detach() {}
+
+bool SnapshotReader::read(Snapshot &) { return false; }
+
+int SnapshotReader::getGridWidth() const { return 0; }
+
+int SnapshotReader::getGridHeight() const { return 0; }
+
+bool SnapshotReader::isStale(sf::Time) const { return true; }
+
+#endif
+
+} // namespace cycles_server
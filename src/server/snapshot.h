@@ -0,0 +1,70 @@
+#pragma once
+#include "server.h"
+#include <SFML/System.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cycles_server {
+
+// The name of the segment where the server listening on port publishes the
+// snapshots of a room
+std::string getSnapshotSegmentName(unsigned short port, int room = 0);
+
+// Publishes the snapshots of the game in a shared memory segment, so that
+// viewers in other processes can draw the game. Publishing never waits for
+// the viewers, they may come and go or crash at any time.
+class SnapshotPublisher {
+  std::string name;
+  void *memory = nullptr;
+  std::size_t size = 0;
+
+public:
+  SnapshotPublisher(const std::string &name, int gridWidth, int gridHeight);
+
+  // Tells the viewers that the server has stopped, and removes the segment
+  ~SnapshotPublisher();
+
+  SnapshotPublisher(const SnapshotPublisher &) = delete;
+  SnapshotPublisher &operator=(const SnapshotPublisher &) = delete;
+
+  bool isOpen() const { return memory != nullptr; }
+
+  void publish(const Snapshot &snapshot);
+};
+
+// Reads the snapshots published by a SnapshotPublisher, in another process
+class SnapshotReader {
+  void *memory = nullptr;
+  std::size_t size = 0;
+  std::uint64_t lastSequence = 0;
+  sf::Clock idleClock; // Since the last new snapshot
+
+public:
+  SnapshotReader() = default;
+  ~SnapshotReader() { detach(); }
+
+  SnapshotReader(const SnapshotReader &) = delete;
+  SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+  // Maps the segment, returns false if the server has not created it yet
+  bool attach(const std::string &name);
+
+  void detach();
+
+  bool isAttached() const { return memory != nullptr; }
+
+  int getGridWidth() const;
+
+  int getGridHeight() const;
+
+  // Copies the newest snapshot if it was not read yet, returns true if it
+  // did
+  bool read(Snapshot &snapshot);
+
+  // The server closed the segment, or published nothing for a while and may
+  // have died. Attaching again picks the segment of a restarted server
+  bool isStale(sf::Time timeout) const;
+};
+
+} // namespace cycles_server
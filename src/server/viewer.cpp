@@ -0,0 +1,59 @@
+#include "renderer.h"
+#include "server.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cstdlib>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <thread>
+
+using namespace cycles_server;
+
+// Draws the game of a server running in the same host, from the snapshots
+// it publishes in shared memory. The server does not notice when viewers
+// start, stop or crash
+int main(int argc, char *argv[]) {
+#if SPDLOG_ACTIVE_LEVEL == SPDLOG_LEVEL_TRACE
+  spdlog::set_level(spdlog::level::debug);
+#endif
+  const char *portenv = std::getenv("CYCLES_PORT");
+  if (portenv == nullptr) {
+    spdlog::critical("Please set the CYCLES_PORT environment variable");
+    exit(1);
+  }
+  // Servers with several rooms publish one segment for each
+  const int room = std::max(cycles::detail::getRequestedRoom(), 0);
+  const auto name = getSnapshotSegmentName(std::stoi(portenv), room);
+  // Only the options about the window are used, the size of the grid is
+  // the one of the server
+  const std::string config_path = argc > 1 ? argv[1] : "config.yaml";
+  Configuration conf(config_path);
+  SnapshotReader reader;
+  spdlog::info("Waiting for the server to publish {}", name);
+  while (!reader.attach(name)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  conf.gridWidth = reader.getGridWidth();
+  conf.gridHeight = reader.getGridHeight();
+  conf.cellSize = conf.gameWidth / float(conf.gridWidth);
+  GameRenderer renderer(conf);
+  Snapshot snapshot;
+  snapshot.waitingForPlayers = true;
+  while (renderer.isOpen()) {
+    renderer.handleEvents();
+    // The server may have been restarted, the last snapshot is kept until
+    // it publishes a new one
+    if (reader.isStale(sf::seconds(1))) {
+      reader.attach(name);
+    }
+    reader.read(snapshot);
+    const bool drawn = snapshot.waitingForPlayers
+                           ? renderer.renderSplashScreen(snapshot)
+                           : renderer.render(snapshot);
+    // The window paces the frames drawn, the others wait here
+    if (!drawn) {
+      sf::sleep(sf::seconds(1.f / maxFramerate));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,1207 @@
+#include "transport.h"
+#include <algorithm>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <thread>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace cycles {
+
+sf::Socket::Status Transport::receive(std::span<const char> &message,
+                                      sf::Time timeout) {
+  sf::Clock clock;
+  while (true) {
+    auto status = receive(message);
+    if (status != sf::Socket::NotReady) {
+      return status;
+    }
+    const auto remaining = timeout - clock.getElapsedTime();
+    if (remaining <= sf::Time::Zero) {
+      return sf::Socket::NotReady;
+    }
+    wait(remaining);
+  }
+}
+
+namespace detail {
+sf::Socket::Status FrameReceiver::receive(sf::TcpSocket &socket) {
+  while (true) {
+    char *destination;
+    std::size_t remaining;
+    if (received < sizeof(header)) {
+      destination = header + received;
+      remaining = sizeof(header) - received;
+    } else {
+      // sf::Packet sends its size in network byte order
+      const auto *bytes = reinterpret_cast<const unsigned char *>(header);
+      const std::size_t size =
+          (std::size_t(bytes[0]) << 24) | (std::size_t(bytes[1]) << 16) |
+          (std::size_t(bytes[2]) << 8) | std::size_t(bytes[3]);
+      if (size > maxSize) {
+        spdlog::error("Received a message of {} bytes, more than {}", size,
+                      maxSize);
+        received = 0;
+        return sf::Socket::Error;
+      }
+      if (received == sizeof(header)) {
+        frame.resize(size);
+      }
+      const std::size_t bodyReceived = received - sizeof(header);
+      if (bodyReceived == size) {
+        received = 0;
+        return sf::Socket::Done;
+      }
+      destination = frame.data() + bodyReceived;
+      remaining = size - bodyReceived;
+    }
+    std::size_t count = 0;
+    auto status = socket.receive(destination, remaining, count);
+    received += count;
+    if (status != sf::Socket::Done) {
+      return status;
+    }
+  }
+}
+
+namespace {
+// sf::Socket::getHandle is protected, but a pointer to it can be formed
+// through a derived class
+struct SocketHandleAccess : sf::Socket {
+  static auto get(const sf::Socket &socket) {
+    return (socket.*&SocketHandleAccess::getHandle)();
+  }
+};
+
+#ifndef _WIN32
+sf::Socket::Status statusFromErrno() {
+  switch (errno) {
+  case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+  case EWOULDBLOCK:
+#endif
+  case EINPROGRESS:
+    return sf::Socket::NotReady;
+  case ECONNABORTED:
+  case ECONNRESET:
+  case ETIMEDOUT:
+  case ENETRESET:
+  case ENOTCONN:
+  case EPIPE:
+    return sf::Socket::Disconnected;
+  default:
+    return sf::Socket::Error;
+  }
+}
+#endif
+
+// Sends the two buffers one after the other, with a single system call where
+// possible
+sf::Socket::Status sendParts(sf::TcpSocket &socket, const char *first,
+                             std::size_t firstSize, const char *second,
+                             std::size_t secondSize, std::size_t &sent) {
+#ifndef _WIN32
+  iovec parts[2];
+  msghdr message{};
+  message.msg_iov = parts;
+  if (firstSize > 0) {
+    parts[message.msg_iovlen++] = {const_cast<char *>(first), firstSize};
+  }
+  if (secondSize > 0) {
+    parts[message.msg_iovlen++] = {const_cast<char *>(second), secondSize};
+  }
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags = MSG_NOSIGNAL;
+#endif
+  const auto result =
+      sendmsg(SocketHandleAccess::get(socket), &message, flags);
+  if (result < 0) {
+    sent = 0;
+    return statusFromErrno();
+  }
+  sent = static_cast<std::size_t>(result);
+  return sent == firstSize + secondSize ? sf::Socket::Done
+                                        : sf::Socket::Partial;
+#else
+  sent = 0;
+  if (firstSize > 0) {
+    auto status = socket.send(first, firstSize, sent);
+    if (status != sf::Socket::Done) {
+      return status;
+    }
+  }
+  if (secondSize == 0) {
+    return sf::Socket::Done;
+  }
+  std::size_t secondSent = 0;
+  auto status = socket.send(second, secondSize, secondSent);
+  sent += secondSent;
+  return status == sf::Socket::NotReady && sent > 0 ? sf::Socket::Partial
+                                                    : status;
+#endif
+}
+} // namespace
+} // namespace detail
+
+TcpTransport::TcpTransport(std::shared_ptr<sf::TcpSocket> socket,
+                           std::size_t maxQueuedBytes,
+                           std::size_t maxMessageSize)
+    : socket(socket), receiver(maxMessageSize),
+      maxQueuedBytes(maxQueuedBytes) {
+  // Waiting for data is done through the selector
+  socket->setBlocking(false);
+  selector.add(*socket);
+}
+
+sf::Socket::Status TcpTransport::send(const sf::Packet &packet) {
+  if (!connected) {
+    return sf::Socket::Disconnected;
+  }
+  if (flush() != sf::Socket::Done) {
+    return enqueue(std::make_shared<const sf::Packet>(packet), false);
+  }
+  const auto *data = static_cast<const char *>(packet.getData());
+  sendBuffer.assign(data, data + packet.getDataSize());
+  sharedMessage = nullptr;
+  beginMessage(sendBuffer.data(), sendBuffer.size());
+  return startSending();
+}
+
+sf::Socket::Status
+TcpTransport::send(std::shared_ptr<const sf::Packet> packet) {
+  if (!connected) {
+    return sf::Socket::Disconnected;
+  }
+  if (flush() != sf::Socket::Done) {
+    return enqueue(packet, false);
+  }
+  // Kept alive until it is completely sent
+  sharedMessage = packet;
+  beginMessage(static_cast<const char *>(packet->getData()),
+               packet->getDataSize());
+  return startSending();
+}
+
+sf::Socket::Status
+TcpTransport::sendLatest(std::shared_ptr<const sf::Packet> packet) {
+  // Older states that did not start to be sent are not worth sending anymore
+  std::erase_if(queue, [this](const QueuedMessage &message) {
+    if (message.latest) {
+      statistics.queuedBytes -= message.packet->getDataSize();
+      ++statistics.messagesDropped;
+    }
+    return message.latest;
+  });
+  if (!connected) {
+    return sf::Socket::Disconnected;
+  }
+  if (flush() != sf::Socket::Done) {
+    return enqueue(packet, true);
+  }
+  sharedMessage = packet;
+  beginMessage(static_cast<const char *>(packet->getData()),
+               packet->getDataSize());
+  return startSending();
+}
+
+sf::Socket::Status
+TcpTransport::enqueue(std::shared_ptr<const sf::Packet> packet, bool latest) {
+  if (!connected) {
+    return sf::Socket::Disconnected;
+  }
+  const auto size = packet->getDataSize();
+  if (statistics.queuedBytes + size > maxQueuedBytes) {
+    return sf::Socket::NotReady;
+  }
+  statistics.queuedBytes += size;
+  queue.push_back({std::move(packet), latest});
+  return sf::Socket::Done;
+}
+
+void TcpTransport::beginMessage(const char *data, std::size_t size) {
+  // Same framing as sf::TcpSocket::send(sf::Packet&)
+  for (int i = 0; i < 4; ++i) {
+    sendHeader[i] = static_cast<char>(static_cast<sf::Uint32>(size) >>
+                                      (24 - 8 * i));
+  }
+  sendData = data;
+  sendSize = size;
+  sent = 0;
+  sending = true;
+}
+
+sf::Socket::Status TcpTransport::startSending() {
+  // What is left is sent by later calls to flush
+  const auto status = flush();
+  return status == sf::Socket::NotReady ? sf::Socket::Done : status;
+}
+
+sf::Socket::Status TcpTransport::flush() {
+  while (connected) {
+    if (!sending) {
+      if (queue.empty()) {
+        return sf::Socket::Done;
+      }
+      sharedMessage = std::move(queue.front().packet);
+      queue.pop_front();
+      statistics.queuedBytes -= sharedMessage->getDataSize();
+      beginMessage(static_cast<const char *>(sharedMessage->getData()),
+                   sharedMessage->getDataSize());
+    }
+    // The header and the message go out in a single system call
+    const std::size_t headerSent = std::min(sent, sizeof(sendHeader));
+    const std::size_t bodySent = sent - headerSent;
+    std::size_t count = 0;
+    auto status = detail::sendParts(
+        *socket, sendHeader + headerSent, sizeof(sendHeader) - headerSent,
+        sendData + bodySent, sendSize - bodySent, count);
+    sent += count;
+    if (sent == sizeof(sendHeader) + sendSize) {
+      sending = false;
+      sharedMessage = nullptr;
+      ++statistics.messagesSent;
+    } else if (status == sf::Socket::NotReady ||
+               status == sf::Socket::Partial || status == sf::Socket::Done) {
+      return sf::Socket::NotReady;
+    } else {
+      connected = false;
+      return status;
+    }
+  }
+  return sf::Socket::Disconnected;
+}
+
+sf::Socket::Status TcpTransport::receive(std::span<const char> &message) {
+  auto status = receiver.receive(*socket);
+  if (status == sf::Socket::Done) {
+    const auto &frame = receiver.getFrame();
+    message = std::span<const char>(frame.data(), frame.size());
+  } else if (status == sf::Socket::Error) {
+    disconnect();
+  } else if (status != sf::Socket::NotReady) {
+    connected = false;
+  }
+  return status;
+}
+
+bool TcpTransport::wait(sf::Time timeout) {
+  return connected && selector.wait(timeout);
+}
+
+bool TcpTransport::isConnected() const {
+  return connected && socket->getRemoteAddress() != sf::IpAddress::None;
+}
+
+sf::SocketHandle TcpTransport::getNativeHandle() const {
+  return detail::SocketHandleAccess::get(*socket);
+}
+
+void TcpTransport::disconnect() {
+  connected = false;
+  selector.clear();
+  socket->disconnect();
+}
+
+sf::Socket::Status InProcessTransport::send(const sf::Packet &packet) {
+  return send(std::make_shared<const sf::Packet>(packet));
+}
+
+sf::Socket::Status
+InProcessTransport::send(std::shared_ptr<const sf::Packet> packet) {
+  return push(std::move(packet), false);
+}
+
+sf::Socket::Status
+InProcessTransport::sendLatest(std::shared_ptr<const sf::Packet> packet) {
+  return push(std::move(packet), true);
+}
+
+sf::Socket::Status
+InProcessTransport::push(std::shared_ptr<const sf::Packet> packet,
+                         bool latest) {
+  {
+    std::scoped_lock lock(outgoing->mutex);
+    if (outgoing->closed) {
+      return sf::Socket::Disconnected;
+    }
+    if (latest) {
+      // The other side has not received them yet, they are not needed anymore
+      const auto dropped = std::erase_if(
+          outgoing->messages, [](const auto &message) { return message.second; });
+      statistics.messagesSent -= dropped;
+      statistics.messagesDropped += dropped;
+    }
+    outgoing->messages.emplace_back(std::move(packet), latest);
+    ++statistics.messagesSent;
+  }
+  outgoing->condition.notify_one();
+  return sf::Socket::Done;
+}
+
+sf::Socket::Status InProcessTransport::receive(std::span<const char> &message) {
+  std::scoped_lock lock(incoming->mutex);
+  if (incoming->messages.empty()) {
+    return incoming->closed ? sf::Socket::Disconnected : sf::Socket::NotReady;
+  }
+  current = std::move(incoming->messages.front().first);
+  incoming->messages.pop_front();
+  message = std::span<const char>(
+      static_cast<const char *>(current->getData()), current->getDataSize());
+  return sf::Socket::Done;
+}
+
+bool InProcessTransport::wait(sf::Time timeout) {
+  std::unique_lock lock(incoming->mutex);
+  auto ready = [this] {
+    return !incoming->messages.empty() || incoming->closed;
+  };
+  if (timeout == sf::Time::Zero) {
+    incoming->condition.wait(lock, ready);
+  } else {
+    incoming->condition.wait_for(
+        lock, std::chrono::microseconds(timeout.asMicroseconds()), ready);
+  }
+  return !incoming->messages.empty();
+}
+
+bool InProcessTransport::isConnected() const {
+  if (disconnected) {
+    return false;
+  }
+  std::scoped_lock lock(incoming->mutex, outgoing->mutex);
+  return (!incoming->closed && !outgoing->closed) ||
+         !incoming->messages.empty();
+}
+
+void InProcessTransport::disconnect() {
+  disconnected = true;
+  for (auto &channel : {incoming, outgoing}) {
+    {
+      std::scoped_lock lock(channel->mutex);
+      channel->closed = true;
+    }
+    channel->condition.notify_all();
+  }
+}
+
+std::pair<std::shared_ptr<Transport>, std::shared_ptr<Transport>>
+makeInProcessTransportPair() {
+  auto toFirst = std::make_shared<detail::InProcessChannel>();
+  auto toSecond = std::make_shared<detail::InProcessChannel>();
+  return {std::make_shared<InProcessTransport>(toFirst, toSecond),
+          std::make_shared<InProcessTransport>(toSecond, toFirst)};
+}
+
+namespace detail {
+namespace {
+constexpr auto udpRequestTag = "cycles-udp";
+// Small enough to never be fragmented by the network
+constexpr std::size_t fragmentSize = 1200;
+// sequence, base, fragment index, fragment count, message size
+constexpr std::size_t fragmentHeaderSize = 16;
+constexpr std::size_t acknowledgementSize = 8; // sequence, base
+constexpr std::size_t helloSize = 12;          // magic, token
+constexpr sf::Uint32 helloMagic = 0x6379636c;  // "cycl"
+constexpr int keyframeInterval = 30;
+const auto repeatInterval = sf::milliseconds(10);
+
+void write16(char *destination, sf::Uint16 value) {
+  destination[0] = static_cast<char>(value >> 8);
+  destination[1] = static_cast<char>(value);
+}
+
+void write32(char *destination, sf::Uint32 value) {
+  for (int i = 0; i < 4; ++i) {
+    destination[i] = static_cast<char>(value >> (24 - 8 * i));
+  }
+}
+
+void append32(std::vector<char> &destination, sf::Uint32 value) {
+  destination.resize(destination.size() + 4);
+  write32(destination.data() + destination.size() - 4, value);
+}
+
+sf::Uint16 read16(const char *source) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(source);
+  return static_cast<sf::Uint16>((bytes[0] << 8) | bytes[1]);
+}
+
+sf::Uint32 read32(const char *source) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(source);
+  return (sf::Uint32(bytes[0]) << 24) | (sf::Uint32(bytes[1]) << 16) |
+         (sf::Uint32(bytes[2]) << 8) | sf::Uint32(bytes[3]);
+}
+
+// Encodes message as its size followed by the runs of bytes that differ from
+// base, each one as its offset, its length and its contents
+void encodeDelta(const std::vector<char> &base, std::span<const char> message,
+                 std::vector<char> &delta) {
+  // Equal bytes cost less than starting a new run
+  constexpr int minimumGap = 8;
+  delta.clear();
+  append32(delta, message.size());
+  const std::size_t common = std::min(base.size(), message.size());
+  std::size_t i = 0;
+  while (i < message.size()) {
+    while (i < common && base[i] == message[i]) {
+      ++i;
+    }
+    if (i == message.size()) {
+      break;
+    }
+    const std::size_t begin = i;
+    std::size_t end = i;
+    int gap = 0;
+    for (; i < message.size() && gap < minimumGap; ++i) {
+      if (i < common && base[i] == message[i]) {
+        ++gap;
+      } else {
+        gap = 0;
+        end = i + 1;
+      }
+    }
+    append32(delta, begin);
+    append32(delta, end - begin);
+    delta.insert(delta.end(), message.begin() + begin, message.begin() + end);
+    i = end;
+  }
+}
+
+bool applyDelta(const std::vector<char> &base, const std::vector<char> &delta,
+                std::vector<char> &message) {
+  if (delta.size() < 4) {
+    return false;
+  }
+  const std::size_t size = read32(delta.data());
+  if (size > maxStateSize) {
+    return false;
+  }
+  message.resize(size);
+  std::copy_n(base.begin(), std::min(base.size(), size), message.begin());
+  std::size_t position = 4;
+  while (position < delta.size()) {
+    if (delta.size() - position < 8) {
+      return false;
+    }
+    const std::size_t offset = read32(delta.data() + position);
+    const std::size_t length = read32(delta.data() + position + 4);
+    position += 8;
+    if (offset > size || length > size - offset ||
+        length > delta.size() - position) {
+      return false;
+    }
+    std::copy_n(delta.begin() + position, length, message.begin() + offset);
+    position += length;
+  }
+  return true;
+}
+} // namespace
+} // namespace detail
+
+UdpTransport::UdpTransport(std::shared_ptr<sf::TcpSocket> socket,
+                           bool isClient)
+    : control(socket, detail::defaultMaxQueuedBytes,
+              isClient ? detail::maxStateSize : detail::maxClientMessageSize),
+      peerAddress(socket->getRemoteAddress()),
+      isClient(isClient), random(std::random_device()()) {
+  udp.bind(sf::Socket::AnyPort);
+  udp.setBlocking(false);
+  selector.add(*socket);
+  selector.add(udp);
+}
+
+std::shared_ptr<UdpTransport>
+UdpTransport::connect(std::shared_ptr<sf::TcpSocket> socket) {
+  std::shared_ptr<UdpTransport> transport(new UdpTransport(socket, true));
+  sf::Packet request;
+  request << detail::udpRequestTag;
+  if (transport->control.send(request) != sf::Socket::Done) {
+    spdlog::error("Failed to send the UDP request");
+    return nullptr;
+  }
+  return transport;
+}
+
+bool UdpTransport::isAttachRequest(std::span<const char> message) {
+  sf::Packet packet;
+  packet.append(message.data(), message.size());
+  std::string tag;
+  return (packet >> tag) && tag == detail::udpRequestTag;
+}
+
+std::shared_ptr<UdpTransport>
+UdpTransport::accept(std::shared_ptr<sf::TcpSocket> socket,
+                     std::span<const char> message) {
+  sf::Packet packet;
+  packet.append(message.data(), message.size());
+  std::string tag;
+  if (!(packet >> tag) || tag != detail::udpRequestTag) {
+    spdlog::error("Invalid UDP request");
+    return nullptr;
+  }
+  std::shared_ptr<UdpTransport> transport(new UdpTransport(socket, false));
+  std::random_device device;
+  transport->token = (static_cast<sf::Uint64>(device()) << 32) | device();
+  sf::Packet reply;
+  reply << detail::udpRequestTag << transport->udp.getLocalPort()
+        << transport->token;
+  if (transport->control.send(reply) != sf::Socket::Done) {
+    spdlog::error("Failed to reply to the UDP request");
+    return nullptr;
+  }
+  return transport;
+}
+
+bool UdpTransport::processReply(std::span<const char> message) {
+  sf::Packet packet;
+  packet.append(message.data(), message.size());
+  std::string tag;
+  sf::Uint16 port = 0;
+  if (!(packet >> tag >> port >> token) || tag != detail::udpRequestTag ||
+      port == 0) {
+    return false;
+  }
+  peerPort = port;
+  sendHello();
+  return true;
+}
+
+void UdpTransport::sendHello() {
+  char hello[detail::helloSize];
+  detail::write32(hello, detail::helloMagic);
+  detail::write32(hello + 4, static_cast<sf::Uint32>(token >> 32));
+  detail::write32(hello + 8, static_cast<sf::Uint32>(token));
+  helloClock.restart();
+  sendDatagram(hello, sizeof(hello));
+}
+
+void UdpTransport::processHello(const char *data, sf::IpAddress address,
+                                unsigned short port) {
+  const sf::Uint64 received =
+      (static_cast<sf::Uint64>(detail::read32(data + 4)) << 32) |
+      detail::read32(data + 8);
+  if (detail::read32(data) != detail::helloMagic || received != token) {
+    return;
+  }
+  if (isClient) {
+    helloAnswered = true;
+    return;
+  }
+  if (peerPort == 0) {
+    // Whatever the NAT in between mapped the client to
+    peerAddress = address;
+    peerPort = port;
+    repeatClock.restart();
+    if (!acknowledged) {
+      sendDatagrams();
+    }
+  }
+  // Answered every time, in case the previous answer was lost
+  sendHello();
+}
+
+sf::Socket::Status UdpTransport::send(const sf::Packet &packet) {
+  return control.send(packet);
+}
+
+sf::Socket::Status
+UdpTransport::sendLatest(std::shared_ptr<const sf::Packet> packet) {
+  if (!isConnected()) {
+    return sf::Socket::Disconnected;
+  }
+  const std::span<const char> message(
+      static_cast<const char *>(packet->getData()), packet->getDataSize());
+  if (lastSequence > 0 && !acknowledged) {
+    // It is not repeated anymore, it may or may not have arrived
+    --statistics.messagesSent;
+    ++statistics.messagesDropped;
+  }
+  ++statistics.messagesSent;
+  const auto sequence = ++lastSequence;
+  bool isKeyframe = !keyframeAcknowledged ||
+                    ++framesSinceKeyframe >= detail::keyframeInterval;
+  if (!isKeyframe) {
+    detail::encodeDelta(keyframe, message, encoded);
+    // Not worth it if most of the message changed
+    isKeyframe = encoded.size() > message.size() / 2;
+  }
+  if (isKeyframe) {
+    keyframe.assign(message.begin(), message.end());
+    keyframeSequence = sequence;
+    keyframeAcknowledged = false;
+    framesSinceKeyframe = 0;
+    encoded = keyframe;
+  }
+  encodedBase = keyframeSequence;
+  acknowledged = false;
+  sendDatagrams();
+  return sf::Socket::Done;
+}
+
+void UdpTransport::sendDatagrams() {
+  constexpr auto stride = detail::fragmentHeaderSize + detail::fragmentSize;
+  const auto count =
+      std::max<std::size_t>(1, (encoded.size() + detail::fragmentSize - 1) /
+                                   detail::fragmentSize);
+  datagrams.resize(count * stride);
+  datagramSizes.clear();
+  if (peerPort == 0) {
+    // Sent once the client says where
+    return;
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto offset = i * detail::fragmentSize;
+    const auto size = std::min(detail::fragmentSize, encoded.size() - offset);
+    char *datagram = datagrams.data() + datagramSizes.size() * stride;
+    if (isLost()) {
+      continue;
+    }
+    detail::write32(datagram, lastSequence);
+    detail::write32(datagram + 4, encodedBase);
+    detail::write16(datagram + 8, static_cast<sf::Uint16>(i));
+    detail::write16(datagram + 10, static_cast<sf::Uint16>(count));
+    detail::write32(datagram + 12, encoded.size());
+    std::copy_n(encoded.begin() + offset, size,
+                datagram + detail::fragmentHeaderSize);
+    datagramSizes.push_back(detail::fragmentHeaderSize + size);
+  }
+  repeatClock.restart();
+#ifdef __linux__
+  // All the datagrams in a single system call
+  peerSocketAddress.sin_family = AF_INET;
+  peerSocketAddress.sin_port = htons(peerPort);
+  peerSocketAddress.sin_addr.s_addr = htonl(peerAddress.toInteger());
+  datagramParts.resize(datagramSizes.size());
+  datagramHeaders.resize(datagramSizes.size());
+  for (std::size_t i = 0; i < datagramSizes.size(); ++i) {
+    datagramParts[i] = {datagrams.data() + i * stride, datagramSizes[i]};
+    datagramHeaders[i] = {};
+    datagramHeaders[i].msg_hdr.msg_name = &peerSocketAddress;
+    datagramHeaders[i].msg_hdr.msg_namelen = sizeof(peerSocketAddress);
+    datagramHeaders[i].msg_hdr.msg_iov = &datagramParts[i];
+    datagramHeaders[i].msg_hdr.msg_iovlen = 1;
+  }
+  const auto handle = detail::SocketHandleAccess::get(udp);
+  std::size_t sent = 0;
+  while (sent < datagramHeaders.size()) {
+    const int result = sendmmsg(handle, datagramHeaders.data() + sent,
+                                datagramHeaders.size() - sent, 0);
+    // Datagrams that do not fit in the socket buffer are just lost
+    if (result <= 0) {
+      break;
+    }
+    sent += result;
+  }
+#else
+  for (std::size_t i = 0; i < datagramSizes.size(); ++i) {
+    udp.send(datagrams.data() + i * stride, datagramSizes[i], peerAddress,
+             peerPort);
+  }
+#endif
+}
+
+bool UdpTransport::isLost() {
+  return simulatedLoss > 0 &&
+         std::uniform_real_distribution<float>()(random) < simulatedLoss;
+}
+
+void UdpTransport::sendDatagram(const char *data, std::size_t size) {
+  if (peerPort == 0 || isLost()) {
+    return;
+  }
+  // A datagram that does not fit in the socket buffer is just lost
+  udp.send(data, size, peerAddress, peerPort);
+}
+
+void UdpTransport::sendAcknowledgement(sf::Uint32 sequence, sf::Uint32 base) {
+  char acknowledgement[detail::acknowledgementSize];
+  detail::write32(acknowledgement, sequence);
+  detail::write32(acknowledgement + 4, base);
+  sendDatagram(acknowledgement, sizeof(acknowledgement));
+}
+
+sf::Socket::Status UdpTransport::flush() {
+  receiveDatagrams();
+  if (!acknowledged && repeatClock.getElapsedTime() >= detail::repeatInterval) {
+    sendDatagrams();
+  }
+  return control.flush();
+}
+
+void UdpTransport::receiveDatagrams() {
+  sf::IpAddress address;
+  unsigned short port;
+  std::size_t size = 0;
+  char buffer[detail::fragmentHeaderSize + detail::fragmentSize];
+  while (udp.receive(buffer, sizeof(buffer), size, address, port) ==
+         sf::Socket::Done) {
+    if (size == detail::helloSize) {
+      processHello(buffer, address, port);
+      continue;
+    }
+    if (peerPort == 0 || address != peerAddress || port != peerPort) {
+      continue;
+    }
+    if (size == detail::acknowledgementSize) {
+      processAcknowledgement(buffer, size);
+    } else if (size > detail::fragmentHeaderSize) {
+      // A state also tells that the hello arrived
+      helloAnswered = true;
+      processFragment(buffer, size);
+    }
+  }
+}
+
+void UdpTransport::processAcknowledgement(const char *data, std::size_t) {
+  const auto sequence = detail::read32(data);
+  const auto base = detail::read32(data + 4);
+  if (base == keyframeSequence) {
+    keyframeAcknowledged = true;
+  }
+  if (sequence == lastSequence) {
+    acknowledged = true;
+  }
+}
+
+void UdpTransport::processFragment(const char *data, std::size_t size) {
+  const auto sequence = detail::read32(data);
+  const auto base = detail::read32(data + 4);
+  const std::size_t index = detail::read16(data + 8);
+  const std::size_t count = detail::read16(data + 10);
+  const std::size_t messageSize = detail::read32(data + 12);
+  if (sequence <= deliveredSequence) {
+    // The acknowledgement was lost, the sender is repeating the message
+    if (sequence == deliveredSequence) {
+      sendAcknowledgement(sequence, base);
+    }
+    return;
+  }
+  if (sequence < assemblySequence || sequence <= readySequence) {
+    return;
+  }
+  if (messageSize > detail::maxStateSize) {
+    return;
+  }
+  if (sequence > assemblySequence) {
+    // Older incomplete messages are abandoned
+    assemblySequence = sequence;
+    assemblyBase = base;
+    assembly.resize(messageSize);
+    fragmentsReceived.assign(count, false);
+    fragmentsMissing = count;
+  }
+  const auto offset = index * detail::fragmentSize;
+  const auto fragment = size - detail::fragmentHeaderSize;
+  if (count != fragmentsReceived.size() || messageSize != assembly.size() ||
+      index >= count || offset > messageSize ||
+      fragment != std::min(detail::fragmentSize, messageSize - offset) ||
+      fragmentsReceived[index]) {
+    return;
+  }
+  std::copy_n(data + detail::fragmentHeaderSize, fragment,
+              assembly.begin() + offset);
+  fragmentsReceived[index] = true;
+  if (--fragmentsMissing == 0 && decodeAssembly()) {
+    readySequence = assemblySequence;
+    readyBase = assemblyBase;
+  }
+}
+
+bool UdpTransport::decodeAssembly() {
+  if (assemblyBase == assemblySequence) {
+    receivedKeyframe = assembly;
+    receivedKeyframeSequence = assemblySequence;
+    decoded = assembly;
+    return true;
+  }
+  // Deltas from a keyframe that was lost cannot be decoded
+  return receivedKeyframeSequence == assemblyBase &&
+         detail::applyDelta(receivedKeyframe, assembly, decoded);
+}
+
+sf::Socket::Status UdpTransport::receive(std::span<const char> &message) {
+  auto status = control.receive(message);
+  if (status == sf::Socket::Done && isClient && peerPort == 0) {
+    // The first message of the server is the reply to the request
+    if (!processReply(message)) {
+      spdlog::error("Invalid reply to the UDP request");
+      disconnect();
+      return sf::Socket::Error;
+    }
+    status = control.receive(message);
+  }
+  if (status != sf::Socket::NotReady) {
+    return status;
+  }
+  receiveDatagrams();
+  if (isClient && peerPort != 0 && !helloAnswered &&
+      helloClock.getElapsedTime() >= detail::repeatInterval) {
+    sendHello();
+  }
+  if (readySequence <= deliveredSequence) {
+    return sf::Socket::NotReady;
+  }
+  deliveredSequence = readySequence;
+  sendAcknowledgement(readySequence, readyBase);
+  // Datagrams received before the next call do not overwrite the message
+  frame.swap(decoded);
+  message = std::span<const char>(frame.data(), frame.size());
+  return sf::Socket::Done;
+}
+
+bool UdpTransport::wait(sf::Time timeout) {
+  if (isClient && !helloAnswered) {
+    // Returns in time for receive to repeat the hello
+    timeout = std::min(timeout, detail::repeatInterval);
+  }
+  return control.isConnected() && selector.wait(timeout);
+}
+
+bool UdpTransport::isConnected() const { return control.isConnected(); }
+
+void UdpTransport::disconnect() {
+  control.disconnect();
+  selector.clear();
+  udp.unbind();
+}
+
+#ifndef _WIN32
+namespace detail {
+namespace {
+constexpr std::uint32_t shmMagic = 0x6379636c; // "cycl"
+constexpr std::uint32_t shmVersion = 1;
+constexpr auto shmRequestTag = "cycles-shm";
+constexpr auto shmPrefix = "/cycles-";
+// Holds a few full states of a 2000x2000 grid. Pages are only allocated when
+// they are written
+constexpr std::uint64_t toClientCapacity = 16 << 20;
+constexpr std::uint64_t toServerCapacity = 64 << 10;
+// Marks that the next message starts at the beginning of the buffer
+constexpr std::uint32_t wrapMarker = 0xFFFFFFFF;
+
+// Messages are stored as their size followed by their contents, starting at
+// multiples of 8 bytes so that the size never straddles the end of the buffer
+std::uint64_t messageSpan(std::size_t size) {
+  return (sizeof(std::uint32_t) + size + 7) & ~std::uint64_t(7);
+}
+
+void futexWait(std::atomic<std::uint32_t> &word, std::uint32_t expected,
+               sf::Time timeout) {
+#ifdef __linux__
+  timespec time;
+  time.tv_sec = timeout.asMicroseconds() / 1000000;
+  time.tv_nsec = (timeout.asMicroseconds() % 1000000) * 1000;
+  // Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT,
+          expected, &time, nullptr, 0);
+#else
+  if (word.load() == expected) {
+    std::this_thread::sleep_for(std::chrono::microseconds(
+        std::min<sf::Int64>(timeout.asMicroseconds(), 100)));
+  }
+#endif
+}
+
+void futexWakeAll(std::atomic<std::uint32_t> &word) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE,
+          INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+void notify(ShmRing &ring) {
+  ring.signal.fetch_add(1);
+  if (ring.waiting.load() > 0) {
+    futexWakeAll(ring.signal);
+  }
+}
+} // namespace
+} // namespace detail
+
+ShmTransport::ShmTransport(std::shared_ptr<sf::TcpSocket> socket, void *memory,
+                           std::size_t memorySize, std::string segmentName,
+                           bool isServer)
+    : socket(socket), memory(memory), memorySize(memorySize),
+      segmentName(segmentName), isServer(isServer) {
+  auto *header = static_cast<detail::ShmHeader *>(memory);
+  incoming = isServer ? &header->toServer : &header->toClient;
+  outgoing = isServer ? &header->toClient : &header->toServer;
+  auto attach = [&](const detail::ShmRing &ring, char *&buffer,
+                    std::uint64_t &capacity) {
+    const auto ringOffset = ring.offset.load();
+    const auto ringCapacity = ring.capacity.load();
+    if (ringOffset >= sizeof(detail::ShmHeader) && ringOffset <= memorySize &&
+        ringCapacity <= memorySize - ringOffset && ringCapacity % 8 == 0 &&
+        ringCapacity > 0) {
+      buffer = static_cast<char *>(memory) + ringOffset;
+      capacity = ringCapacity;
+    }
+  };
+  attach(*incoming, incomingBuffer, incomingCapacity);
+  attach(*outgoing, outgoingBuffer, outgoingCapacity);
+  // Messages start at multiples of 8, see messageSpan
+  readPosition = incoming->tail.load() & ~std::uint64_t(7);
+  socket->setBlocking(false);
+}
+
+std::shared_ptr<ShmTransport>
+ShmTransport::connect(std::shared_ptr<sf::TcpSocket> socket) {
+  static std::atomic<int> segmentCount = 0;
+  const auto name = std::string(detail::shmPrefix) +
+                    std::to_string(getpid()) + "-" +
+                    std::to_string(segmentCount++);
+  const std::size_t size = sizeof(detail::ShmHeader) +
+                           detail::toClientCapacity + detail::toServerCapacity;
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    spdlog::error("Failed to create shared memory segment {}", name);
+    return nullptr;
+  }
+  void *memory = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    spdlog::error("Failed to map shared memory segment {}", name);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  auto *header = new (memory) detail::ShmHeader();
+  header->version = detail::shmVersion;
+  header->toClient.capacity = detail::toClientCapacity;
+  header->toClient.offset = sizeof(detail::ShmHeader);
+  header->toServer.capacity = detail::toServerCapacity;
+  header->toServer.offset =
+      sizeof(detail::ShmHeader) + detail::toClientCapacity;
+  header->magic.store(detail::shmMagic, std::memory_order_release);
+  std::shared_ptr<ShmTransport> transport(
+      new ShmTransport(socket, memory, size, name, false));
+  sf::Packet request;
+  request << detail::shmRequestTag << name << detail::shmVersion;
+  socket->setBlocking(true);
+  const auto status = socket->send(request);
+  socket->setBlocking(false);
+  if (status != sf::Socket::Done) {
+    spdlog::error("Failed to send the shared memory request");
+    return nullptr;
+  }
+  return transport;
+}
+
+bool ShmTransport::isAttachRequest(std::span<const char> message) {
+  sf::Packet packet;
+  packet.append(message.data(), message.size());
+  std::string tag;
+  return (packet >> tag) && tag == detail::shmRequestTag;
+}
+
+std::shared_ptr<ShmTransport>
+ShmTransport::accept(std::shared_ptr<sf::TcpSocket> socket,
+                     std::span<const char> message) {
+  sf::Packet packet;
+  packet.append(message.data(), message.size());
+  std::string tag, name;
+  sf::Uint32 version = 0;
+  packet >> tag >> name >> version;
+  // Do not let clients make the server open arbitrary segments
+  if (!packet || version != detail::shmVersion ||
+      name.rfind(detail::shmPrefix, 0) != 0) {
+    spdlog::error("Invalid shared memory request");
+    return nullptr;
+  }
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    spdlog::error("Failed to open shared memory segment {}", name);
+    return nullptr;
+  }
+  // Both sides have it open from now on, it is removed once they unmap it
+  shm_unlink(name.c_str());
+  struct stat info;
+  void *memory = MAP_FAILED;
+  std::size_t size = 0;
+  if (fstat(fd, &info) == 0 &&
+      static_cast<std::size_t>(info.st_size) >= sizeof(detail::ShmHeader)) {
+    size = info.st_size;
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    spdlog::error("Failed to map shared memory segment {}", name);
+    return nullptr;
+  }
+  const auto *header = static_cast<const detail::ShmHeader *>(memory);
+  if (header->magic.load(std::memory_order_acquire) != detail::shmMagic ||
+      header->version != detail::shmVersion) {
+    spdlog::error("Invalid shared memory segment {}", name);
+    munmap(memory, size);
+    return nullptr;
+  }
+  std::shared_ptr<ShmTransport> transport(
+      new ShmTransport(socket, memory, size, name, true));
+  if (transport->incomingBuffer == nullptr ||
+      transport->outgoingBuffer == nullptr) {
+    spdlog::error("Invalid shared memory segment {}", name);
+    return nullptr;
+  }
+  return transport;
+}
+
+ShmTransport::~ShmTransport() {
+  disconnect();
+  munmap(memory, memorySize);
+  if (!isServer) {
+    // In case the server never attached
+    shm_unlink(segmentName.c_str());
+  }
+}
+
+sf::Socket::Status ShmTransport::send(const sf::Packet &packet) {
+  if (!isLinked()) {
+    return sf::Socket::Disconnected;
+  }
+  const std::size_t size = packet.getDataSize();
+  const auto capacity = outgoingCapacity;
+  if (detail::messageSpan(size) > capacity) {
+    spdlog::error("Message of {} bytes does not fit in shared memory", size);
+    return sf::Socket::Error;
+  }
+  char *buffer = outgoingBuffer;
+  // Only this side writes the head
+  auto head = outgoing->head.load(std::memory_order_relaxed);
+  const auto tail = outgoing->tail.load(std::memory_order_acquire);
+  auto offset = head % capacity;
+  const std::uint64_t skip =
+      offset + sizeof(std::uint32_t) + size > capacity ? capacity - offset : 0;
+  if (head + skip + detail::messageSpan(size) - tail > capacity) {
+    // The receiver is lagging behind
+    return sf::Socket::NotReady;
+  }
+  if (skip > 0) {
+    std::memcpy(buffer + offset, &detail::wrapMarker, sizeof(std::uint32_t));
+    head += skip;
+    offset = 0;
+  }
+  const auto size32 = static_cast<std::uint32_t>(size);
+  std::memcpy(buffer + offset, &size32, sizeof(size32));
+  if (size > 0) {
+    std::memcpy(buffer + offset + sizeof(size32), packet.getData(), size);
+  }
+  outgoing->head.store(head + detail::messageSpan(size),
+                       std::memory_order_release);
+  detail::notify(*outgoing);
+  ++statistics.messagesSent;
+  return sf::Socket::Done;
+}
+
+sf::Socket::Status ShmTransport::receive(std::span<const char> &message) {
+  // The previous message is not used anymore, its space can be reused
+  incoming->tail.store(readPosition, std::memory_order_release);
+  const auto capacity = incomingCapacity;
+  const char *buffer = incomingBuffer;
+  const auto head = incoming->head.load(std::memory_order_acquire);
+  while (readPosition != head) {
+    const auto offset = readPosition % capacity;
+    std::uint32_t size;
+    std::memcpy(&size, buffer + offset, sizeof(size));
+    if (size == detail::wrapMarker) {
+      readPosition += capacity - offset;
+      continue;
+    }
+    if (offset + sizeof(size) + size > capacity) {
+      disconnect();
+      return sf::Socket::Error;
+    }
+    message = std::span<const char>(buffer + offset + sizeof(size), size);
+    readPosition += detail::messageSpan(size);
+    return sf::Socket::Done;
+  }
+  checkSocket();
+  return isConnected() ? sf::Socket::NotReady : sf::Socket::Disconnected;
+}
+
+bool ShmTransport::wait(sf::Time timeout) {
+  // Wake up from time to time to notice if the other side died
+  const auto checkPeriod = sf::milliseconds(100);
+  sf::Clock clock;
+  while (isConnected()) {
+    incoming->waiting.fetch_add(1);
+    const auto signal = incoming->signal.load();
+    if (incoming->head.load(std::memory_order_acquire) != readPosition) {
+      incoming->waiting.fetch_sub(1);
+      return true;
+    }
+    auto slice = checkPeriod;
+    if (timeout != sf::Time::Zero) {
+      const auto remaining = timeout - clock.getElapsedTime();
+      if (remaining <= sf::Time::Zero) {
+        incoming->waiting.fetch_sub(1);
+        return false;
+      }
+      slice = std::min(slice, remaining);
+    }
+    detail::futexWait(incoming->signal, signal, slice);
+    incoming->waiting.fetch_sub(1);
+    checkSocket();
+  }
+  return false;
+}
+
+void ShmTransport::checkSocket() {
+  if (!connected ||
+      socketCheckClock.getElapsedTime() < sf::milliseconds(100)) {
+    return;
+  }
+  socketCheckClock.restart();
+  // Nothing else is sent through the socket, it only tells if the other side
+  // is still alive
+  char byte;
+  std::size_t count = 0;
+  const auto status = socket->receive(&byte, sizeof(byte), count);
+  if (status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+    connected = false;
+  }
+}
+
+bool ShmTransport::isLinked() const {
+  const auto *header = static_cast<const detail::ShmHeader *>(memory);
+  return connected && header->closed.load() == 0;
+}
+
+bool ShmTransport::isConnected() const {
+  if (disconnected) {
+    return false;
+  }
+  return isLinked() ||
+         incoming->head.load(std::memory_order_acquire) != readPosition;
+}
+
+void ShmTransport::disconnect() {
+  auto *header = static_cast<detail::ShmHeader *>(memory);
+  header->closed.store(1);
+  detail::notify(header->toClient);
+  detail::notify(header->toServer);
+  connected = false;
+  disconnected = true;
+  socket->disconnect();
+}
+#endif
+
+} // namespace cycles
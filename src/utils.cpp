@@ -1,4 +1,5 @@
 #include "utils.h"
+#include <chrono>
 namespace cycles {
 std::string socketErrorToString(const sf::Socket::Status status) {
   switch (status) {
@@ -44,4 +45,10 @@ sf::Vector2i getDirectionVector(Direction direction) {
   return vector;
 }
 
+sf::Int64 getMonotonicTime() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
 } // namespace cycles
@@ -0,0 +1,66 @@
+// GTest tests for the game states read by the clients
+#include "api.h"
+#include "gtest/gtest.h"
+#include <SFML/Network.hpp>
+
+using cycles::GameState;
+using cycles::Id;
+
+TEST(GameStateTest, CellsOutsideTheWindowAreUnknown) {
+  GameState state;
+  state.gridWidth = 10;
+  state.gridHeight = 10;
+  state.windowX = 4;
+  state.windowY = 2;
+  state.windowWidth = 3;
+  state.windowHeight = 2;
+  state.grid = {0, 1, 0, 2, 0, 3};
+  EXPECT_EQ(state.getGridCell({5, 2}), 1);
+  EXPECT_EQ(state.getGridCell({6, 3}), 3);
+  EXPECT_TRUE(state.isCellEmpty({4, 2}));
+  EXPECT_FALSE(state.isCellEmpty({4, 3}));
+  // Cells of the grid outside the window, and cells outside the grid
+  for (auto position : {sf::Vector2i(1, 0), sf::Vector2i(3, 2),
+                        sf::Vector2i(7, 2), sf::Vector2i(4, 4),
+                        sf::Vector2i(-1, 2), sf::Vector2i(0, 0)}) {
+    EXPECT_EQ(state.getGridCell(position), GameState::unknownCell);
+    EXPECT_FALSE(state.isCellEmpty(position));
+  }
+  EXPECT_EQ(state.getWindowCell({3, 0}), GameState::unknownCell);
+  EXPECT_EQ(state.getWindowCell({0, -1}), GameState::unknownCell);
+}
+
+namespace {
+
+// A state with a header as the server would send it, then the given counts
+sf::Packet makeState(sf::Uint32 playerCount, sf::Int32 windowWidth,
+                     sf::Int32 windowHeight) {
+  sf::Packet packet;
+  packet << sf::Int32(10) << sf::Int32(10) << playerCount;
+  packet << sf::Int64(0) << sf::Int64(0);
+  packet << sf::Int32(0) << sf::Int32(0) << windowWidth << windowHeight;
+  return packet;
+}
+
+// Whether the client accepts the state, and stays connected
+bool receive(const sf::Packet &packet) {
+  auto [serverEnd, clientEnd] = cycles::makeInProcessTransportPair();
+  cycles::Connection connection(clientEnd);
+  serverEnd->send(packet);
+  GameState state;
+  return connection.tryReceiveGameState(state) && connection.isActive();
+}
+
+} // namespace
+
+TEST(GameStateTest, RejectsCountsLargerThanTheState) {
+  auto valid = makeState(0, 2, 1);
+  valid << sf::Uint8(0) << sf::Uint8(0);
+  EXPECT_TRUE(receive(valid));
+  // None of these may allocate for the counts they claim
+  EXPECT_FALSE(receive(makeState(0xffffffff, 0, 0)));
+  EXPECT_FALSE(receive(makeState(0, 0x7fffffff, 0x7fffffff)));
+  EXPECT_FALSE(receive(makeState(0, -1, -1)));
+  EXPECT_FALSE(receive(makeState(0, -2, 1)));
+  EXPECT_FALSE(receive(makeState(0, 3, 1)));
+}
@@ -1,6 +1,7 @@
 //GTest tests for game logic
 #include"server/game_logic.h"
 #include"gtest/gtest.h"
+#include<algorithm>
 #include<fstream>
 using cycles::Id;
 using namespace cycles_server;
@@ -155,3 +156,36 @@ TEST(GameLogicTest, Grid){
   auto players = game.getPlayers();
   EXPECT_TRUE(test_grid(grid, players, conf));
 }
+
+TEST(GameLogicTest, ViewWindow){
+  // Write some yaml conf to a temp file
+  std::string conf_file = writeConfig();
+  Configuration conf(conf_file);
+  Game game(conf);
+  auto window = game.getViewWindow(sf::Vector2i(50, 50), 5);
+  EXPECT_EQ(window, sf::IntRect(45, 45, 11, 11));
+  // Windows near the borders are clipped to the grid
+  window = game.getViewWindow(sf::Vector2i(2, 97), 5);
+  EXPECT_EQ(window, sf::IntRect(0, 92, 8, 8));
+  window = game.getViewWindow(sf::Vector2i(50, 50), 1000);
+  EXPECT_EQ(window, sf::IntRect(0, 0, conf.gridWidth, conf.gridHeight));
+}
+
+TEST(GameLogicTest, Reset){
+  // Write some yaml conf to a temp file
+  std::string conf_file = writeConfig();
+  Configuration conf(conf_file);
+  Game game(conf);
+  Id id = game.addPlayer("player1");
+  game.addPlayer("player2");
+  std::map<Id, Direction> directions;
+  directions[id] = Direction::north;
+  game.movePlayers(directions);
+  game.reset();
+  EXPECT_EQ(game.getPlayers().size(), 0);
+  EXPECT_FALSE(game.isGameOver());
+  const auto &grid = game.getGrid();
+  EXPECT_TRUE(std::all_of(grid.begin(), grid.end(), [](auto cell) { return cell == 0; }));
+  // Ids are given again from the start
+  EXPECT_EQ(game.addPlayer("player2"), 1);
+}
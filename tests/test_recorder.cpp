@@ -0,0 +1,98 @@
+//GTest tests for the recording of the frames drawn
+#include"server/recorder.h"
+#include"gtest/gtest.h"
+#include<filesystem>
+#include<fstream>
+#include<iterator>
+#include<unistd.h>
+using namespace cycles_server;
+
+class RecorderTest : public ::testing::Test {
+protected:
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() /
+      ("cycles-recorder-test-" + std::to_string(getpid()));
+
+  void TearDown() override { std::filesystem::remove_all(directory); }
+
+  static sf::Image makeImage(sf::Uint8 value, unsigned width = 8) {
+    sf::Image image;
+    image.create(width, 4, sf::Color(value, value, value));
+    return image;
+  }
+};
+
+TEST_F(RecorderTest, ParseFormat) {
+  FrameRecorder::Format format;
+  ASSERT_TRUE(FrameRecorder::parseFormat("png", format));
+  EXPECT_EQ(format, FrameRecorder::Format::Png);
+  ASSERT_TRUE(FrameRecorder::parseFormat("raw", format));
+  EXPECT_EQ(format, FrameRecorder::Format::Raw);
+  EXPECT_FALSE(FrameRecorder::parseFormat("gif", format));
+}
+
+TEST_F(RecorderTest, SavesNumberedImages) {
+  {
+    FrameRecorder recorder(directory.string(), FrameRecorder::Format::Png, 2,
+                           8);
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_TRUE(recorder.push(makeImage(i * 100)));
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    sf::Image image;
+    ASSERT_TRUE(image.loadFromFile(
+        (directory / ("frame_00000" + std::to_string(i) + ".png")).string()));
+    EXPECT_EQ(image.getSize(), sf::Vector2u(8, 4));
+    EXPECT_EQ(image.getPixel(3, 2), sf::Color(i * 100, i * 100, i * 100));
+  }
+}
+
+TEST_F(RecorderTest, RawFramesAreInOrder) {
+  constexpr int frames = 20;
+  std::uint64_t recorded = 0;
+  std::uint64_t dropped = 0;
+  {
+    FrameRecorder recorder(directory.string(), FrameRecorder::Format::Raw, 4,
+                           4);
+    for (int i = 0; i < frames; ++i) {
+      recorder.push(makeImage(i));
+    }
+    // The recorder keeps recording until it is destroyed
+    while (recorder.getRecordedFrames() + recorder.getDroppedFrames() <
+           frames) {
+      sf::sleep(sf::milliseconds(1));
+    }
+    recorded = recorder.getRecordedFrames();
+    dropped = recorder.getDroppedFrames();
+  }
+  EXPECT_EQ(recorded + dropped, std::uint64_t(frames));
+  std::ifstream file(directory / "frames.rgba", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  ASSERT_EQ(bytes.size(), recorded * 8 * 4 * 4);
+  // Dropped frames leave no gaps, the ones kept are in the order pushed
+  int previous = -1;
+  for (std::size_t frame = 0; frame < recorded; ++frame) {
+    const int value = static_cast<unsigned char>(bytes[frame * 8 * 4 * 4]);
+    EXPECT_GT(value, previous);
+    previous = value;
+  }
+}
+
+TEST_F(RecorderTest, RawFramesKeepTheFirstSize) {
+  {
+    FrameRecorder recorder(directory.string(), FrameRecorder::Format::Raw, 1,
+                           8);
+    ASSERT_TRUE(recorder.push(makeImage(1)));
+    EXPECT_FALSE(recorder.push(makeImage(2, 16)));
+    ASSERT_TRUE(recorder.push(makeImage(3)));
+    EXPECT_EQ(recorder.getRejectedFrames(), 1u);
+  }
+  std::ifstream file(directory / "frames.rgba", std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  ASSERT_EQ(bytes.size(), 2u * 8 * 4 * 4);
+  EXPECT_EQ(bytes[0], 1);
+  EXPECT_EQ(bytes[8 * 4 * 4], 3);
+}
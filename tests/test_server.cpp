@@ -0,0 +1,174 @@
+// GTest tests for the routing of the clients to the rooms and the phases of
+// the rooms, with in-process clients like the bots loaded by the server
+#include "api.h"
+#include "server/game_server.h"
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+using namespace cycles_server;
+
+namespace {
+
+Configuration makeConfiguration(int rooms) {
+  Configuration conf("");
+  conf.rooms = rooms;
+  conf.workers = 1;
+  conf.gridWidth = 20;
+  conf.gridHeight = 20;
+  return conf;
+}
+
+// Waits a few seconds at most
+bool waitForPhase(Room &room, Room::Phase phase) {
+  sf::Clock clock;
+  while (room.getPhase() != phase) {
+    if (clock.getElapsedTime() > sf::seconds(5)) {
+      return false;
+    }
+    sf::sleep(sf::milliseconds(1));
+  }
+  return true;
+}
+
+// Returns once the server replied with the color or closed the connection.
+// The client never answers the states, so it is dropped once the match starts
+std::unique_ptr<cycles::Connection> join(GameServer &server,
+                                         const std::string &name) {
+  auto [serverEnd, clientEnd] = cycles::makeInProcessTransportPair();
+  server.addClient(serverEnd);
+  auto connection = std::make_unique<cycles::Connection>(clientEnd);
+  connection->connect(name);
+  return connection;
+}
+
+} // namespace
+
+class GameServerTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    // Any free port, the tests run in parallel
+    setenv("CYCLES_PORT", "0", 1);
+    unsetenv("CYCLES_ROOM");
+  }
+
+  void TearDown() override { unsetenv("CYCLES_ROOM"); }
+};
+
+TEST_F(GameServerTest, FillsTheLobbiesFirst) {
+  auto conf = makeConfiguration(2);
+  conf.startPlayers = 2;
+  // The matches do not get past their first frame during the test
+  conf.frameTime = 60000;
+  GameServer server(conf, sf::Time::Zero);
+  server.start();
+  auto first = join(server, "first");
+  auto second = join(server, "second");
+  ASSERT_TRUE(waitForPhase(server.getRoom(0), Room::Phase::Playing));
+  EXPECT_EQ(server.getRoom(1).getPhase(), Room::Phase::Lobby);
+  auto third = join(server, "third");
+  auto fourth = join(server, "fourth");
+  ASSERT_TRUE(waitForPhase(server.getRoom(1), Room::Phase::Playing));
+  EXPECT_EQ(server.getRoom(0).getReservedPlayers(), 2);
+  EXPECT_EQ(server.getRoom(1).getReservedPlayers(), 2);
+  EXPECT_TRUE(fourth->isActive());
+  // Both rooms play their only match, nobody else can join
+  auto fifth = join(server, "fifth");
+  EXPECT_FALSE(fifth->isActive());
+  server.stop();
+}
+
+TEST_F(GameServerTest, PlaysTheMatchesInPhases) {
+  auto conf = makeConfiguration(1);
+  conf.startPlayers = 2;
+  conf.matches = 2;
+  conf.frameTime = 0;
+  GameServer server(conf, sf::milliseconds(200));
+  auto &room = server.getRoom(0);
+  EXPECT_EQ(room.getPhase(), Room::Phase::Lobby);
+  server.start();
+  auto first = join(server, "first");
+  auto second = join(server, "second");
+  EXPECT_TRUE(second->isActive());
+  // The players do not answer, so the match ends after its first frame
+  ASSERT_TRUE(waitForPhase(room, Room::Phase::Result));
+  EXPECT_TRUE(room.willPlayAgain());
+  ASSERT_TRUE(waitForPhase(room, Room::Phase::Lobby));
+  EXPECT_EQ(room.getReservedPlayers(), 0);
+  auto third = join(server, "third");
+  auto fourth = join(server, "fourth");
+  EXPECT_TRUE(fourth->isActive());
+  ASSERT_TRUE(waitForPhase(room, Room::Phase::Finished));
+  EXPECT_TRUE(server.isFinished());
+  EXPECT_FALSE(room.willPlayAgain());
+  auto late = join(server, "late");
+  EXPECT_FALSE(late->isActive());
+  server.stop();
+}
+
+TEST_F(GameServerTest, ClientsChooseTheirRoom) {
+  auto conf = makeConfiguration(3);
+  conf.startPlayers = 2;
+  GameServer server(conf, sf::Time::Zero);
+  server.start();
+  setenv("CYCLES_ROOM", "2", 1);
+  auto chosen = join(server, "chosen");
+  EXPECT_TRUE(chosen->isActive());
+  EXPECT_EQ(server.getRoom(2).getReservedPlayers(), 1);
+  EXPECT_EQ(server.getRoom(0).getReservedPlayers(), 0);
+  // Rooms that do not exist are ignored
+  setenv("CYCLES_ROOM", "7", 1);
+  auto missing = join(server, "missing");
+  EXPECT_TRUE(missing->isActive());
+  EXPECT_EQ(server.getRoom(0).getReservedPlayers(), 1);
+  EXPECT_EQ(server.getRoom(1).getReservedPlayers(), 0);
+  server.stop();
+}
+
+TEST_F(GameServerTest, SilentClientsDoNotHoldBackOthers) {
+  auto conf = makeConfiguration(1);
+  conf.startPlayers = 2;
+  GameServer server(conf, sf::Time::Zero);
+  server.start();
+  sf::TcpSocket silent;
+  ASSERT_EQ(silent.connect(sf::IpAddress::LocalHost, server.getPort()),
+            sf::Socket::Done);
+  sf::Clock clock;
+  auto player = join(server, "player");
+  EXPECT_TRUE(player->isActive());
+  // Well below the time the server gives the silent client to send its name
+  EXPECT_LT(clock.getElapsedTime(), sf::milliseconds(500));
+  // Which is then dropped
+  sf::SocketSelector selector;
+  selector.add(silent);
+  ASSERT_TRUE(selector.wait(sf::seconds(5)));
+  char byte;
+  std::size_t received = 0;
+  EXPECT_EQ(silent.receive(&byte, 1, received), sf::Socket::Disconnected);
+  server.stop();
+}
+
+TEST_F(GameServerTest, ClientsThatLeaveBeforeTheirColorAreNotCounted) {
+  auto conf = makeConfiguration(1);
+  conf.startPlayers = 2;
+  conf.frameTime = 60000;
+  GameServer server(conf, sf::Time::Zero);
+  server.start();
+  // Sends its name and leaves, so the room fails to send its color
+  auto [serverEnd, clientEnd] = cycles::makeInProcessTransportPair();
+  sf::Packet name;
+  name << std::string("gone") << sf::Int32(0) << sf::Int32(-1);
+  ASSERT_EQ(clientEnd->send(name), sf::Socket::Done);
+  clientEnd->disconnect();
+  server.addClient(serverEnd);
+  sf::sleep(sf::milliseconds(200));
+  EXPECT_EQ(server.getRoom(0).getReservedPlayers(), 0);
+  auto first = join(server, "first");
+  EXPECT_TRUE(first->isActive());
+  EXPECT_EQ(server.getRoom(0).getPhase(), Room::Phase::Lobby);
+  auto second = join(server, "second");
+  ASSERT_TRUE(waitForPhase(server.getRoom(0), Room::Phase::Playing));
+  EXPECT_EQ(server.getRoom(0).getReservedPlayers(), 2);
+  server.stop();
+}
@@ -0,0 +1,58 @@
+//GTest tests for the snapshots published for the viewers
+#include"server/snapshot.h"
+#include"gtest/gtest.h"
+#include<memory>
+#include<unistd.h>
+using namespace cycles_server;
+
+class SnapshotTest : public ::testing::Test {
+protected:
+  const std::string name = "/cycles-snapshot-test-" + std::to_string(getpid());
+
+  static Snapshot makeSnapshot(int frame) {
+    Snapshot snapshot;
+    snapshot.frame = frame;
+    snapshot.gridWidth = 20;
+    snapshot.gridHeight = 10;
+    snapshot.grid.assign(200, 0);
+    snapshot.grid[frame % 200] = 1;
+    cycles::Player player;
+    player.id = 1;
+    player.name = "a player with a name too long to be kept whole";
+    player.color = sf::Color(10, 20, 30);
+    player.position = sf::Vector2i(frame % 20, 3);
+    snapshot.players.push_back(player);
+    return snapshot;
+  }
+};
+
+TEST_F(SnapshotTest, PublishAndRead) {
+  SnapshotReader reader;
+  EXPECT_FALSE(reader.attach(name));
+  auto publisher = std::make_unique<SnapshotPublisher>(name, 20, 10);
+  ASSERT_TRUE(publisher->isOpen());
+  ASSERT_TRUE(reader.attach(name));
+  EXPECT_EQ(reader.getGridWidth(), 20);
+  EXPECT_EQ(reader.getGridHeight(), 10);
+  Snapshot snapshot;
+  // Nothing published yet
+  EXPECT_FALSE(reader.read(snapshot));
+  publisher->publish(makeSnapshot(5));
+  ASSERT_TRUE(reader.read(snapshot));
+  const auto expected = makeSnapshot(5);
+  EXPECT_EQ(snapshot.frame, 5);
+  EXPECT_EQ(snapshot.grid, expected.grid);
+  ASSERT_EQ(snapshot.players.size(), 1u);
+  EXPECT_EQ(snapshot.players[0].color, expected.players[0].color);
+  EXPECT_EQ(snapshot.players[0].position, expected.players[0].position);
+  EXPECT_EQ(snapshot.players[0].name, expected.players[0].name.substr(0, 31));
+  // Only new snapshots are read
+  EXPECT_FALSE(reader.read(snapshot));
+  publisher->publish(makeSnapshot(6));
+  ASSERT_TRUE(reader.read(snapshot));
+  EXPECT_EQ(snapshot.frame, 6);
+  EXPECT_FALSE(reader.isStale(sf::seconds(10)));
+  publisher.reset();
+  EXPECT_TRUE(reader.isStale(sf::seconds(10)));
+  EXPECT_FALSE(reader.attach(name));
+}
@@ -0,0 +1,293 @@
+//GTest tests for the transports
+#include"transport.h"
+#include"gtest/gtest.h"
+#include<cstring>
+#include<memory>
+#include<vector>
+#ifndef _WIN32
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<unistd.h>
+#endif
+using namespace cycles;
+
+// Links a client and a server UdpTransport through the loopback interface
+class UdpTransportTest : public ::testing::Test {
+protected:
+  std::shared_ptr<UdpTransport> client;
+  std::shared_ptr<UdpTransport> server;
+
+  void SetUp() override {
+    sf::TcpListener listener;
+    ASSERT_EQ(listener.listen(sf::Socket::AnyPort), sf::Socket::Done);
+    auto clientSocket = std::make_shared<sf::TcpSocket>();
+    ASSERT_EQ(clientSocket->connect(sf::IpAddress::LocalHost,
+                                    listener.getLocalPort()),
+              sf::Socket::Done);
+    auto serverSocket = std::make_shared<sf::TcpSocket>();
+    ASSERT_EQ(listener.accept(*serverSocket), sf::Socket::Done);
+    client = UdpTransport::connect(clientSocket);
+    ASSERT_NE(client, nullptr);
+    TcpTransport control(serverSocket);
+    std::span<const char> request;
+    ASSERT_EQ(control.receive(request, sf::seconds(1)), sf::Socket::Done);
+    ASSERT_TRUE(UdpTransport::isAttachRequest(request));
+    server = UdpTransport::accept(serverSocket, request);
+    ASSERT_NE(server, nullptr);
+  }
+
+  // A state-like message, most of it is the same from one frame to the next
+  static std::shared_ptr<sf::Packet> makeMessage(sf::Uint32 frame) {
+    std::vector<char> cells(10000, 0);
+    for (sf::Uint32 i = 0; i <= frame; ++i) {
+      cells[(i * 37) % cells.size()] = static_cast<char>(1 + i % 5);
+    }
+    auto packet = std::make_shared<sf::Packet>();
+    *packet << frame;
+    packet->append(cells.data(), cells.size());
+    return packet;
+  }
+
+  static bool sameContents(std::span<const char> message,
+                           const sf::Packet &packet) {
+    return message.size() == packet.getDataSize() &&
+           std::equal(message.begin(), message.end(),
+                      static_cast<const char *>(packet.getData()));
+  }
+
+  static sf::Uint32 getFrame(std::span<const char> message) {
+    sf::Packet packet;
+    packet.append(message.data(), message.size());
+    sf::Uint32 frame = 0;
+    packet >> frame;
+    return frame;
+  }
+
+  // Sends frames and answers each one as a bot would, returns the number of
+  // frames the client received. Each attempt waits longer than the repeat
+  // interval, so every attempt that fails repeats the frame once
+  int play(int frames, float loss) {
+    client->setSimulatedLoss(loss, 1);
+    server->setSimulatedLoss(loss, 2);
+    int received = 0;
+    sf::Uint32 lastFrame = 0;
+    for (int frame = 1; frame <= frames; ++frame) {
+      const auto message = makeMessage(frame);
+      EXPECT_EQ(server->sendLatest(message), sf::Socket::Done);
+      std::span<const char> state;
+      for (int attempt = 0; attempt < 20; ++attempt) {
+        server->flush();
+        if (client->receive(state, sf::milliseconds(11)) == sf::Socket::Done) {
+          const auto receivedFrame = getFrame(state);
+          // Only new frames are delivered, and exactly as they were sent
+          EXPECT_GT(receivedFrame, lastFrame);
+          EXPECT_TRUE(sameContents(state, *makeMessage(receivedFrame)));
+          lastFrame = receivedFrame;
+          ++received;
+          sf::Packet move;
+          move << static_cast<sf::Int32>(frame);
+          EXPECT_EQ(client->send(move), sf::Socket::Done);
+          client->flush();
+          break;
+        }
+      }
+    }
+    return received;
+  }
+};
+
+TEST_F(UdpTransportTest, ControlMessages) {
+  sf::Packet request;
+  request << std::string("name") << sf::Int32(3);
+  ASSERT_EQ(client->send(request), sf::Socket::Done);
+  std::span<const char> message;
+  ASSERT_EQ(server->receive(message, sf::seconds(1)), sf::Socket::Done);
+  EXPECT_TRUE(sameContents(message, request));
+  sf::Packet reply;
+  reply << sf::Uint8(1) << sf::Uint8(2) << sf::Uint8(3);
+  ASSERT_EQ(server->send(reply), sf::Socket::Done);
+  ASSERT_EQ(client->receive(message, sf::seconds(1)), sf::Socket::Done);
+  EXPECT_TRUE(sameContents(message, reply));
+}
+
+TEST_F(UdpTransportTest, NoLoss) {
+  EXPECT_EQ(play(100, 0), 100);
+}
+
+TEST_F(UdpTransportTest, SimulatedLoss) {
+  // Lost frames are repeated until they arrive, so at most a few are skipped
+  const int received = play(100, 0.2f);
+  EXPECT_GT(received, 90);
+}
+
+TEST_F(UdpTransportTest, Disconnection) {
+  server->disconnect();
+  std::span<const char> message;
+  client->receive(message, sf::seconds(1));
+  EXPECT_FALSE(client->isConnected());
+}
+
+// The size of a message comes from the peer, larger ones than allowed must
+// not be allocated
+TEST(TcpTransportTest, RejectsOversizedMessages) {
+  sf::TcpListener listener;
+  ASSERT_EQ(listener.listen(sf::Socket::AnyPort), sf::Socket::Done);
+  sf::TcpSocket peer;
+  ASSERT_EQ(peer.connect(sf::IpAddress::LocalHost, listener.getLocalPort()),
+            sf::Socket::Done);
+  auto socket = std::make_shared<sf::TcpSocket>();
+  ASSERT_EQ(listener.accept(*socket), sf::Socket::Done);
+  TcpTransport transport(socket, detail::defaultMaxQueuedBytes, 1000);
+  sf::Packet small;
+  small.append(std::vector<char>(1000).data(), 1000);
+  ASSERT_EQ(peer.send(small), sf::Socket::Done);
+  std::span<const char> message;
+  ASSERT_EQ(transport.receive(message, sf::seconds(1)), sf::Socket::Done);
+  EXPECT_EQ(message.size(), 1000u);
+  const unsigned char header[] = {0xff, 0xff, 0xff, 0xf0};
+  ASSERT_EQ(peer.send(header, sizeof(header)), sf::Socket::Done);
+  EXPECT_EQ(transport.receive(message, sf::seconds(1)), sf::Socket::Error);
+  EXPECT_FALSE(transport.isConnected());
+}
+
+TEST(InProcessTransportTest, SendLatestDropsStaleStates) {
+  auto [server, client] = makeInProcessTransportPair();
+  sf::Packet control;
+  control << sf::Int32(7);
+  ASSERT_EQ(server->send(control), sf::Socket::Done);
+  for (sf::Uint32 frame = 1; frame <= 3; ++frame) {
+    auto state = std::make_shared<sf::Packet>();
+    *state << frame;
+    ASSERT_EQ(server->sendLatest(state), sf::Socket::Done);
+  }
+  // Control messages are kept, only the newest state is
+  std::span<const char> message;
+  ASSERT_EQ(client->receive(message), sf::Socket::Done);
+  EXPECT_EQ(message.size(), sizeof(sf::Int32));
+  ASSERT_EQ(client->receive(message), sf::Socket::Done);
+  sf::Packet state;
+  state.append(message.data(), message.size());
+  sf::Uint32 frame = 0;
+  state >> frame;
+  EXPECT_EQ(frame, 3u);
+  EXPECT_EQ(client->receive(message), sf::Socket::NotReady);
+  EXPECT_EQ(server->getStatistics().messagesSent, 2u);
+  EXPECT_EQ(server->getStatistics().messagesDropped, 2u);
+}
+
+TEST(InProcessTransportTest, QueuedMessagesOutliveDisconnection) {
+  auto [server, client] = makeInProcessTransportPair();
+  for (sf::Uint32 frame = 1; frame <= 2; ++frame) {
+    sf::Packet state;
+    state << frame;
+    ASSERT_EQ(server->send(state), sf::Socket::Done);
+  }
+  server->disconnect();
+  EXPECT_FALSE(server->isConnected());
+  // The client still gets the last states, as it would through TCP
+  std::span<const char> message;
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(client->isConnected());
+    EXPECT_EQ(client->receive(message), sf::Socket::Done);
+  }
+  EXPECT_FALSE(client->isConnected());
+  EXPECT_EQ(client->receive(message), sf::Socket::Disconnected);
+}
+
+#ifndef _WIN32
+// Connects the sockets through which a client asks a server to attach to its
+// shared memory
+class ShmTransportTest : public ::testing::Test {
+protected:
+  std::shared_ptr<sf::TcpSocket> clientSocket;
+  std::shared_ptr<sf::TcpSocket> serverSocket;
+
+  void SetUp() override {
+    sf::TcpListener listener;
+    ASSERT_EQ(listener.listen(sf::Socket::AnyPort), sf::Socket::Done);
+    clientSocket = std::make_shared<sf::TcpSocket>();
+    ASSERT_EQ(clientSocket->connect(sf::IpAddress::LocalHost,
+                                    listener.getLocalPort()),
+              sf::Socket::Done);
+    serverSocket = std::make_shared<sf::TcpSocket>();
+    ASSERT_EQ(listener.accept(*serverSocket), sf::Socket::Done);
+  }
+
+  std::shared_ptr<ShmTransport> accept() {
+    TcpTransport control(serverSocket);
+    std::span<const char> request;
+    if (control.receive(request, sf::seconds(1)) != sf::Socket::Done ||
+        !ShmTransport::isAttachRequest(request)) {
+      return nullptr;
+    }
+    return ShmTransport::accept(serverSocket, request);
+  }
+};
+
+TEST_F(ShmTransportTest, QueuedMessagesOutliveDisconnection) {
+  auto client = ShmTransport::connect(clientSocket);
+  ASSERT_NE(client, nullptr);
+  auto server = accept();
+  ASSERT_NE(server, nullptr);
+  for (sf::Uint32 frame = 1; frame <= 2; ++frame) {
+    sf::Packet state;
+    state << frame;
+    ASSERT_EQ(server->send(state), sf::Socket::Done);
+  }
+  server->disconnect();
+  EXPECT_FALSE(server->isConnected());
+  sf::Packet late;
+  EXPECT_EQ(server->send(late), sf::Socket::Disconnected);
+  std::span<const char> message;
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(client->isConnected());
+    EXPECT_EQ(client->receive(message), sf::Socket::Done);
+  }
+  EXPECT_FALSE(client->isConnected());
+  EXPECT_EQ(client->receive(message), sf::Socket::Disconnected);
+}
+
+// The client can write the header at any time, the server must keep using
+// the rings it checked when attaching
+TEST_F(ShmTransportTest, IgnoresRingsMovedAfterAttaching) {
+  const std::string name = "/cycles-test-" + std::to_string(getpid());
+  const std::size_t capacity = 4096;
+  const std::size_t size = sizeof(detail::ShmHeader) + 2 * capacity;
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(ftruncate(fd, size), 0);
+  void *memory =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(memory, MAP_FAILED);
+  auto *header = new (memory) detail::ShmHeader();
+  header->version = 1;
+  header->toClient.capacity = capacity;
+  header->toClient.offset = sizeof(detail::ShmHeader);
+  header->toServer.capacity = capacity;
+  header->toServer.offset = sizeof(detail::ShmHeader) + capacity;
+  header->magic.store(0x6379636c);
+  sf::Packet request;
+  request << std::string("cycles-shm") << name << sf::Uint32(1);
+  ASSERT_EQ(clientSocket->send(request), sf::Socket::Done);
+  auto server = accept();
+  ASSERT_NE(server, nullptr);
+  header->toClient.offset = std::uint64_t(1) << 40;
+  header->toClient.capacity = std::uint64_t(1) << 41;
+  header->toServer.offset = std::uint64_t(1) << 40;
+  header->toServer.capacity = std::uint64_t(1) << 41;
+  sf::Packet state;
+  state << sf::Uint32(7);
+  ASSERT_EQ(server->send(state), sf::Socket::Done);
+  // Still written where the ring was
+  const char *ring =
+      static_cast<const char *>(memory) + sizeof(detail::ShmHeader);
+  std::uint32_t messageSize = 0;
+  std::memcpy(&messageSize, ring, sizeof(messageSize));
+  EXPECT_EQ(messageSize, state.getDataSize());
+  std::span<const char> message;
+  EXPECT_EQ(server->receive(message), sf::Socket::NotReady);
+  server = nullptr;
+  munmap(memory, size);
+}
+#endif